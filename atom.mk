@@ -13,8 +13,11 @@ LOCAL_EXPORT_CUSTOM_VARIABLES := LIBVIDEOBUFFERS_HEADERS=$\
 LOCAL_CFLAGS := -DVBUF_API_EXPORTS -fvisibility=hidden -std=gnu99
 LOCAL_SRC_FILES := \
 	src/vbuf.c \
+	src/vbuf_copy.c \
 	src/vbuf_pool.c \
-	src/vbuf_queue.c
+	src/vbuf_queue.c \
+	src/vbuf_reclaim.c \
+	src/vbuf_worker.c
 LOCAL_LIBRARIES := \
 	libfutils \
 	libpomp \
@@ -39,3 +42,48 @@ LOCAL_LIBRARIES := \
 	libvideo-buffers
 
 include $(BUILD_LIBRARY)
+
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := vbuf-bench
+LOCAL_CATEGORY_PATH := libs/video-buffers
+LOCAL_DESCRIPTION := Video buffers library benchmarks
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_SRC_FILES := \
+	bench/vbuf_bench.c \
+	bench/vbuf_bench_copy.c \
+	bench/vbuf_bench_policy.c \
+	bench/vbuf_bench_pool.c
+LOCAL_LIBRARIES := \
+	libfutils \
+	libvideo-buffers \
+	libvideo-buffers-generic
+
+include $(BUILD_EXECUTABLE)
+
+
+ifdef TARGET_TEST
+
+include $(CLEAR_VARS)
+LOCAL_MODULE := tst-video-buffers
+LOCAL_CATEGORY_PATH := libs/video-buffers
+LOCAL_DESCRIPTION := Video buffers library tests
+LOCAL_CFLAGS := -std=gnu99
+LOCAL_CXXFLAGS := -std=c++11
+LOCAL_SRC_FILES := \
+	tests/vbuf_test.c \
+	tests/vbuf_test_cpp.cpp \
+	tests/vbuf_test_dirty.c \
+	tests/vbuf_test_meta.c \
+	tests/vbuf_test_pool.c \
+	tests/vbuf_test_queue.c \
+	tests/vbuf_test_ref.c
+LOCAL_LIBRARIES := \
+	libcunit \
+	libfutils \
+	libvideo-buffers \
+	libvideo-buffers-generic
+
+include $(BUILD_EXECUTABLE)
+
+endif
@@ -0,0 +1,74 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_bench.h"
+
+
+struct vbuf_bench {
+	const char *name;
+	const char *desc;
+	int (*fn)(int argc, char *argv[]);
+};
+
+
+static const struct vbuf_bench s_benches[] = {
+	{"copy", "payload copy throughput per kernel and size", vbuf_bench_copy},
+	{"pool", "locked vs lock-free free list contention", vbuf_bench_pool},
+	{"policy", "buffers reuse policy cache effect", vbuf_bench_policy},
+};
+
+
+static void usage(const char *progname)
+{
+	size_t i;
+
+	printf("Usage: %s <bench> [args]\n", progname);
+	printf("Benchmarks:\n");
+	for (i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++)
+		printf("  %-8s %s\n", s_benches[i].name, s_benches[i].desc);
+}
+
+
+int main(int argc, char *argv[])
+{
+	size_t i;
+
+	if (argc < 2) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (i = 0; i < sizeof(s_benches) / sizeof(s_benches[0]); i++) {
+		if (strcmp(argv[1], s_benches[i].name) != 0)
+			continue;
+		return ((*s_benches[i].fn)(argc - 1, &argv[1]) == 0)
+			       ? EXIT_SUCCESS
+			       : EXIT_FAILURE;
+	}
+
+	usage(argv[0]);
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,179 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "vbuf_bench.h"
+
+
+/* Bytes copied per measurement */
+#define VBUF_BENCH_COPY_TOTAL (512 * 1024 * 1024)
+
+
+static const char *const s_kernels[] = {
+	"memcpy",
+	"sse2",
+	"avx2",
+	"avx512",
+};
+
+
+static const size_t s_sizes[] = {
+	64 * 1024,
+	256 * 1024,
+	1024 * 1024,
+	4 * 1024 * 1024,
+	16 * 1024 * 1024,
+	64 * 1024 * 1024,
+};
+
+
+/* Measure vbuf_copy() and memcpy() for a given size; the copy kernel is
+ * selected by the library on the first copy */
+static int vbuf_bench_copy_size(const char *kernel, size_t size)
+{
+	int res;
+	unsigned int i, count;
+	uint64_t start, copy_us, memcpy_us;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *src = NULL, *dst = NULL;
+	uint8_t *src_data, *dst_data;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	if (res < 0)
+		return res;
+	res = vbuf_new(size, 0, &cbs, NULL, &src);
+	if (res < 0)
+		goto out;
+	res = vbuf_new(size, 0, &cbs, NULL, &dst);
+	if (res < 0)
+		goto out;
+	src_data = vbuf_get_data(src);
+	memset(src_data, 0x5a, size);
+	res = vbuf_set_size(src, size);
+	if (res < 0)
+		goto out;
+
+	/* Warm up: allocate the destination pages */
+	res = vbuf_copy(src, dst);
+	if (res < 0)
+		goto out;
+	dst_data = vbuf_get_data(dst);
+
+	count = VBUF_BENCH_COPY_TOTAL / size;
+	start = vbuf_bench_time_us();
+	for (i = 0; i < count; i++)
+		vbuf_copy(src, dst);
+	copy_us = vbuf_bench_time_us() - start;
+
+	start = vbuf_bench_time_us();
+	for (i = 0; i < count; i++) {
+		memcpy(dst_data, src_data, size);
+		/* Keep the compiler from eliding the copies */
+		__asm__ __volatile__("" : : "r"(dst_data) : "memory");
+	}
+	memcpy_us = vbuf_bench_time_us() - start;
+
+	printf("%-8s %10zu %10.2f %10.2f %8.2f\n",
+	       kernel,
+	       size,
+	       vbuf_bench_gbps((uint64_t)count * size, copy_us),
+	       vbuf_bench_gbps((uint64_t)count * size, memcpy_us),
+	       (copy_us > 0) ? (double)memcpy_us / (double)copy_us : 0.);
+
+out:
+	if (src != NULL)
+		vbuf_unref(src);
+	if (dst != NULL)
+		vbuf_unref(dst);
+	return res;
+}
+
+
+/* Run the sizes for a kernel in a child process: the library selects
+ * the kernel once per process */
+static int vbuf_bench_copy_kernel(const char *kernel)
+{
+	int status = 0;
+	size_t i;
+	pid_t pid;
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+
+	if (pid == 0) {
+		setenv("VBUF_COPY_KERNEL", kernel, 1);
+		for (i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++) {
+			if (vbuf_bench_copy_size(kernel, s_sizes[i]) < 0)
+				_exit(EXIT_FAILURE);
+		}
+		fflush(stdout);
+		_exit(EXIT_SUCCESS);
+	}
+
+	if (waitpid(pid, &status, 0) < 0)
+		return -errno;
+
+	return (WIFEXITED(status) && (WEXITSTATUS(status) == EXIT_SUCCESS))
+		       ? 0
+		       : -EIO;
+}
+
+
+/* Usage: copy [kernel...] (all kernels by default); kernels that are not
+ * available on the CPU fall back to memcpy, and copies below the library
+ * non-temporal threshold always use memcpy */
+int vbuf_bench_copy(int argc, char *argv[])
+{
+	int res, i;
+
+	printf("%-8s %10s %10s %10s %8s\n",
+	       "kernel",
+	       "size",
+	       "vbuf GB/s",
+	       "libc GB/s",
+	       "speedup");
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++) {
+			res = vbuf_bench_copy_kernel(argv[i]);
+			if (res < 0)
+				return res;
+		}
+		return 0;
+	}
+
+	for (i = 0; i < (int)(sizeof(s_kernels) / sizeof(s_kernels[0])); i++) {
+		res = vbuf_bench_copy_kernel(s_kernels[i]);
+		if (res < 0)
+			return res;
+	}
+
+	return 0;
+}
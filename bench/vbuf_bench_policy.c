@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_bench.h"
+
+
+/* Buffers in the pool */
+#define VBUF_BENCH_POLICY_COUNT 32
+
+/* Bytes written and read back per measurement */
+#define VBUF_BENCH_POLICY_TOTAL (1024 * 1024 * 1024)
+
+
+static const struct {
+	const char *name;
+	enum vbuf_pool_policy policy;
+} s_policies[] = {
+	{"fifo", VBUF_POOL_POLICY_FIFO},
+	{"lifo", VBUF_POOL_POLICY_LIFO},
+	{"cpu", VBUF_POOL_POLICY_CPU_AFFINE},
+};
+
+
+static const size_t s_sizes[] = {
+	4 * 1024,
+	16 * 1024,
+	64 * 1024,
+	256 * 1024,
+	1024 * 1024,
+};
+
+
+/* Measure a producer/consumer loop for a given policy and buffer size:
+ * a buffer is taken from the pool, its payload is written then read
+ * back, and it is returned to the pool */
+static int vbuf_bench_policy_run(const char *name,
+				 enum vbuf_pool_policy policy,
+				 size_t size)
+{
+	int res;
+	unsigned int i, count;
+	uint64_t start, us, sum = 0;
+	size_t j;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_buffer *buf;
+	uint64_t *data;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	if (res < 0)
+		return res;
+
+	memset(&config, 0, sizeof(config));
+	config.count = VBUF_BENCH_POLICY_COUNT;
+	config.capacity = size;
+	config.policy = policy;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	if (res < 0)
+		return res;
+
+	count = VBUF_BENCH_POLICY_TOTAL / size;
+	start = vbuf_bench_time_us();
+	for (i = 0; i < count; i++) {
+		res = vbuf_pool_get(pool, 0, &buf);
+		if (res < 0)
+			break;
+		data = (uint64_t *)vbuf_get_data(buf);
+		memset(data, i, size);
+		for (j = 0; j < size / sizeof(*data); j++)
+			sum += data[j];
+		vbuf_unref(buf);
+	}
+	us = vbuf_bench_time_us() - start;
+
+	if (res == 0) {
+		printf("%-8s %10zu %10.2f %12.0f\n",
+		       name,
+		       size,
+		       vbuf_bench_gbps((uint64_t)count * size, us),
+		       (us > 0) ? (double)count * 1000000. / (double)us : 0.);
+	}
+
+	/* Keep the compiler from eliding the reads */
+	__asm__ __volatile__("" : : "r"(sum));
+
+	vbuf_pool_destroy(pool);
+	return res;
+}
+
+
+/* Usage: policy; the FIFO policy reuses the least recently returned (and
+ * cache-cold) buffer, the other policies the most recently returned one */
+int vbuf_bench_policy(int argc, char *argv[])
+{
+	int res;
+	size_t i, j;
+
+	printf("%-8s %10s %10s %12s\n", "policy", "size", "GB/s", "buffers/s");
+
+	for (i = 0; i < sizeof(s_sizes) / sizeof(s_sizes[0]); i++) {
+		for (j = 0; j < sizeof(s_policies) / sizeof(s_policies[0]);
+		     j++) {
+			res = vbuf_bench_policy_run(s_policies[j].name,
+						    s_policies[j].policy,
+						    s_sizes[i]);
+			if (res < 0)
+				return res;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+#include "vbuf_bench.h"
+
+
+/* Get/put operations per thread and per measurement */
+#define VBUF_BENCH_POOL_OPS (1000 * 1000)
+
+/* Buffers per thread in the pool: getters never have to wait */
+#define VBUF_BENCH_POOL_BUFS_PER_THREAD 4
+
+/* Maximum thread count */
+#define VBUF_BENCH_POOL_MAX_THREADS 16
+
+
+static const unsigned int s_thread_counts[] = {1, 2, 4, 8, 16};
+
+
+struct vbuf_bench_pool_thread {
+	pthread_t thread;
+	struct vbuf_pool *pool;
+	int *start;
+	int res;
+};
+
+
+static void *vbuf_bench_pool_thread(void *userdata)
+{
+	struct vbuf_bench_pool_thread *t = userdata;
+	struct vbuf_buffer *buf;
+	unsigned int i;
+
+	/* Wait for all the threads to be created */
+	while (!__atomic_load_n(t->start, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	for (i = 0; i < VBUF_BENCH_POOL_OPS; i++) {
+		t->res = vbuf_pool_get(t->pool, -1, &buf);
+		if (t->res < 0)
+			break;
+		vbuf_unref(buf);
+	}
+
+	return NULL;
+}
+
+
+/* Measure concurrent vbuf_pool_get()/vbuf_unref() on a pool with a
+ * locked or a lock-free free list */
+static int vbuf_bench_pool_run(int lock_free, unsigned int thread_count)
+{
+	int res, go = 0;
+	unsigned int i, started = 0;
+	uint64_t start, us;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_bench_pool_thread threads[VBUF_BENCH_POOL_MAX_THREADS];
+
+	res = vbuf_generic_get_cbs(&cbs);
+	if (res < 0)
+		return res;
+
+	memset(&config, 0, sizeof(config));
+	config.count = thread_count * VBUF_BENCH_POOL_BUFS_PER_THREAD;
+	config.capacity = 64;
+	config.lock_free = lock_free;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	if (res < 0)
+		return res;
+
+	for (i = 0; i < thread_count; i++) {
+		threads[i].pool = pool;
+		threads[i].start = &go;
+		threads[i].res = 0;
+		res = pthread_create(&threads[i].thread,
+				     NULL,
+				     vbuf_bench_pool_thread,
+				     &threads[i]);
+		if (res != 0) {
+			res = -res;
+			break;
+		}
+		started++;
+	}
+
+	start = vbuf_bench_time_us();
+	__atomic_store_n(&go, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+		if (threads[i].res < 0)
+			res = threads[i].res;
+	}
+	us = vbuf_bench_time_us() - start;
+
+	if (res == 0) {
+		printf("%-10s %8u %12.0f\n",
+		       lock_free ? "lock_free" : "locked",
+		       thread_count,
+		       (us > 0) ? (double)thread_count * VBUF_BENCH_POOL_OPS *
+					  1000000. / (double)us
+				: 0.);
+	}
+
+	vbuf_pool_destroy(pool);
+	return res;
+}
+
+
+/* Usage: pool; each thread gets a buffer and returns it to the pool in a
+ * loop, the total operations rate is reported per free list type and
+ * thread count */
+int vbuf_bench_pool(int argc, char *argv[])
+{
+	int res, lock_free;
+	size_t i;
+
+	printf("%-10s %8s %12s\n", "free list", "threads", "ops/s");
+
+	for (lock_free = 0; lock_free <= 1; lock_free++) {
+		for (i = 0;
+		     i < sizeof(s_thread_counts) / sizeof(s_thread_counts[0]);
+		     i++) {
+			res = vbuf_bench_pool_run(lock_free,
+						  s_thread_counts[i]);
+			if (res < 0)
+				return res;
+		}
+	}
+
+	return 0;
+}
@@ -38,12 +38,24 @@ extern "C" {
  * Get the generic implementation callback functions.
  * This function fills a buffer callback structure with the function pointers
  * and user data pointers for the generic malloc/free implementation.
+ * The generic implementation supports the VBUF_NEW_INLINE_PAYLOAD flag of
+ * vbuf_new_single().
  * @param cbs: pointer on a buffer callback functions structure (output)
  * @return 0 on success, negative errno value in case of error
  */
 VBUF_API int vbuf_generic_get_cbs(struct vbuf_cbs *cbs);
 
 
+/**
+ * Get the generic implementation static callback functions table.
+ * The returned table lives as long as the library and can be used with
+ * the VBUF_NEW_STATIC_CBS flag of vbuf_new_single(), so that the buffers
+ * reference it instead of holding a private copy.
+ * @return pointer on the static callback functions table
+ */
+VBUF_API const struct vbuf_cbs *vbuf_generic_get_static_cbs(void);
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
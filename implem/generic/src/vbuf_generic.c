@@ -38,36 +38,35 @@ ULOG_DECLARE_TAG(vbuf_generic);
 #define VBUF_TYPE_GENERIC 0x56425546 /* "VBUF" */
 
 
-struct vbuf_generic {
-	/* nothing to do here */
-	void *dummy;
-};
+/* Payload memory is aligned on a cache line so that planes can be
+ * aligned for SIMD accesses */
+static uint8_t *vbuf_generic_aligned_alloc(size_t size)
+{
+	void *ptr = NULL;
+
+	if (posix_memalign(&ptr, VBUF_CACHE_LINE_SIZE, size) != 0)
+		return NULL;
+
+	return ptr;
+}
 
 
 static int vbuf_generic_alloc_cb(struct vbuf_buffer *buf, void *userdata)
 {
-	int res = 0;
-
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
 	buf->type = VBUF_TYPE_GENERIC;
 
-	buf->specific = calloc(1, sizeof(struct vbuf_generic));
-	if (buf->specific == NULL)
-		return -ENOMEM;
-	if (buf->capacity > 0) {
-		buf->ptr = calloc(1, buf->capacity);
-		if (buf->ptr == NULL) {
-			res = -ENOMEM;
-			goto error;
-		}
+	/* No platform-specific data is needed */
+	buf->specific = NULL;
+	if ((buf->capacity > 0) && (buf->inline_capacity == 0)) {
+		buf->ptr = vbuf_generic_aligned_alloc(buf->capacity);
+		if (buf->ptr == NULL)
+			return -ENOMEM;
+		memset(buf->ptr, 0, buf->capacity);
 	}
 
 	return 0;
-
-error:
-	free(buf->specific);
-	return res;
 }
 
 
@@ -77,11 +76,30 @@ static int vbuf_generic_realloc_cb(struct vbuf_buffer *buf, void *userdata)
 
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
-	if (buf->capacity > 0) {
-		uint8_t *tmp = realloc(buf->ptr, buf->capacity);
+	if ((buf->capacity > 0) && (buf->inline_capacity > 0)) {
+		/* Move the data out of the buffer object memory block */
+		uint8_t *tmp = vbuf_generic_aligned_alloc(buf->capacity);
 		if (tmp == NULL)
 			return -ENOMEM;
+		memcpy(tmp, buf->ptr, buf->inline_capacity);
 		buf->ptr = tmp;
+		buf->inline_capacity = 0;
+	} else if (buf->capacity > 0) {
+		uint8_t *tmp = realloc(buf->ptr, buf->capacity);
+		if (tmp == NULL)
+			return -ENOMEM;
+		if (((uintptr_t)tmp & (VBUF_CACHE_LINE_SIZE - 1)) != 0) {
+			/* Restore the payload alignment */
+			buf->ptr = vbuf_generic_aligned_alloc(buf->capacity);
+			if (buf->ptr == NULL) {
+				buf->ptr = tmp;
+				return -ENOMEM;
+			}
+			memcpy(buf->ptr, tmp, buf->capacity);
+			free(tmp);
+		} else {
+			buf->ptr = tmp;
+		}
 	}
 
 	return res;
@@ -92,15 +110,24 @@ static int vbuf_generic_free_cb(struct vbuf_buffer *buf, void *userdata)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
-	free(buf->ptr);
+	if (buf->inline_capacity == 0)
+		free(buf->ptr);
 	buf->ptr = NULL;
-	free(buf->specific);
-	buf->specific = NULL;
+	buf->inline_capacity = 0;
 
 	return 0;
 }
 
 
+/* Generic implementation callback functions table, referenced by the
+ * buffers created with the VBUF_NEW_STATIC_CBS flag */
+static const struct vbuf_cbs s_generic_cbs = {
+	.alloc = vbuf_generic_alloc_cb,
+	.realloc = vbuf_generic_realloc_cb,
+	.free = vbuf_generic_free_cb,
+};
+
+
 int vbuf_generic_get_cbs(struct vbuf_cbs *cbs)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
@@ -115,3 +142,9 @@ int vbuf_generic_get_cbs(struct vbuf_cbs *cbs)
 
 	return 0;
 }
+
+
+const struct vbuf_cbs *vbuf_generic_get_static_cbs(void)
+{
+	return &s_generic_cbs;
+}
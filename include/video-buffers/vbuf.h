@@ -28,6 +28,7 @@
 #define _VBUF_H_
 
 #include <stdint.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
 #ifdef __cplusplus
@@ -46,6 +47,14 @@ extern "C" {
 #endif /* !VBUF_API_EXPORTS */
 
 
+/* Maximum number of planes of a buffer payload */
+#define VBUF_MAX_PLANES 4
+
+
+/* Maximum number of size classes of a buffer pool */
+#define VBUF_POOL_MAX_CLASSES 16
+
+
 /* Forward declarations */
 struct vbuf_buffer;
 struct vbuf_pool;
@@ -164,6 +173,184 @@ struct vbuf_cbs {
 };
 
 
+/* Buffer creation flags (see vbuf_new_single()) */
+
+/* Allocate the payload memory in the same memory block as the buffer
+ * object. The buffer ptr member is then already set when the alloc
+ * callback is called and the inline_capacity member is not null; the
+ * implementation must not free this memory, and must move the data to
+ * a new memory area on reallocation. This flag must only be used with
+ * implementations that support it (e.g. the generic implementation). */
+#define VBUF_NEW_INLINE_PAYLOAD (1 << 0)
+
+/* Reference the callback functions table instead of copying it: the
+ * table must outlive the buffer (e.g. a static table owned by the
+ * implementation, see vbuf_generic_get_static_cbs()). */
+#define VBUF_NEW_STATIC_CBS (1 << 1)
+
+
+/**
+ * Asynchronous copy completion callback function.
+ * This function is called from an internal worker thread once the
+ * destination buffer is no longer write-locked.
+ * @param src_buf: pointer on the source buffer object
+ * @param dst_buf: pointer on the destination buffer object
+ * @param status: 0 on success, negative errno value in case of error
+ * @param userdata: user data pointer
+ */
+typedef void (*vbuf_copy_cb_t)(struct vbuf_buffer *src_buf,
+			       struct vbuf_buffer *dst_buf,
+			       int status,
+			       void *userdata);
+
+
+/* Buffer payload plane descriptor */
+struct vbuf_plane {
+	/* Offset of the first plane row in the buffer payload in bytes */
+	size_t offset;
+
+	/* Distance between the starts of two consecutive rows in bytes
+	 * (including padding) */
+	size_t stride;
+
+	/* Plane rows count */
+	size_t height;
+
+	/* Plane alignment in bytes (power of 2, 0 or 1 if none); the plane
+	 * start address and its stride are multiples of this value */
+	size_t align;
+};
+
+
+/* Buffer pool size class */
+struct vbuf_pool_class {
+	/* Class buffers capacity */
+	size_t capacity;
+
+	/* Class buffer count (mandatory); minimum count if elastic */
+	unsigned int count;
+
+	/* Class maximum buffer count (0 if equal to count) */
+	unsigned int max_count;
+};
+
+
+/* Buffer pool size class statistics */
+struct vbuf_pool_class_stats {
+	/* Class buffers capacity */
+	size_t capacity;
+
+	/* Current class buffer count */
+	unsigned int count;
+
+	/* Currently available class buffers count */
+	unsigned int free;
+
+	/* Number of vbuf_pool_get_sized() requests for which this class is
+	 * the smallest class large enough */
+	uint64_t requests;
+
+	/* Number of these requests served by a larger class */
+	uint64_t fallbacks;
+
+	/* Number of these requests that failed */
+	uint64_t failures;
+};
+
+
+/* Buffer pool reuse policy */
+enum vbuf_pool_policy {
+	/* Buffers are reused in the order they are returned to the pool
+	 * (the least recently returned buffer is reused first) */
+	VBUF_POOL_POLICY_FIFO = 0,
+
+	/* The most recently returned buffer is reused first, while its
+	 * memory is still likely to be in the CPU caches; not supported
+	 * with a lock-free free list */
+	VBUF_POOL_POLICY_LIFO,
+
+	/* The buffer most recently returned on the current CPU is reused
+	 * first; this enables the per-CPU caches (with a default batch
+	 * size if magazine_size is 0) in front of a LIFO free list (FIFO
+	 * with a lock-free free list) */
+	VBUF_POOL_POLICY_CPU_AFFINE,
+};
+
+
+/* Buffer pool configuration */
+struct vbuf_pool_config {
+	/* Buffer count (mandatory); minimum buffer count of elastic pools */
+	unsigned int count;
+
+	/* Maximum buffer count (0 if equal to count): when greater than
+	 * count, the pool is elastic and vbuf_pool_get() allocates a new
+	 * buffer when none is available, until this count is reached */
+	unsigned int max_count;
+
+	/* Elastic pools idle timeout (0 to disable): free buffers above
+	 * the minimum count that have not been used for this duration are
+	 * released in the background (see also vbuf_pool_trim()) */
+	unsigned int idle_timeout_ms;
+
+	/* Individual buffer capacity (can be 0 and reallocated later) */
+	size_t capacity;
+
+	/* Individual user data buffer capacity (can be 0) */
+	size_t userdata_capacity;
+
+	/* Individual metadata arena capacity (can be 0); metadata added to
+	 * a buffer is stored in this memory area (including a small
+	 * per-entry header) which is reset when the buffer returns to the
+	 * pool; when the arena is full, metadata is allocated on the heap */
+	size_t metadata_capacity;
+
+	/* Individual buffer payload planes count (can be 0) */
+	unsigned int plane_count;
+
+	/* Individual buffer payload planes descriptors (see
+	 * vbuf_set_planes()), restored when buffers are returned to the
+	 * pool; the capacity must be large enough for all planes */
+	struct vbuf_plane planes[VBUF_MAX_PLANES];
+
+	/* Deferred release of the buffers (see vbuf_set_deferred_release()):
+	 * when not null, the buffers are returned to the pool by the
+	 * reclaimer thread */
+	int deferred_release;
+
+	/* Lock-free free list: when not null, buffers are taken from and
+	 * returned to the pool without locking its mutex, which is only used
+	 * by vbuf_pool_get() callers that have to wait for a buffer; the
+	 * pool event is only signaled when the free list was empty (see
+	 * vbuf_pool_get_evt()) */
+	int lock_free;
+
+	/* Per-CPU caches batch size (0 to disable, at most 32): when not
+	 * null, each CPU keeps up to twice this number of free buffers,
+	 * exchanged with the shared free list in batches of this size; the
+	 * pool event is only signaled when a CPU cache was empty (see
+	 * vbuf_pool_get_evt()) */
+	unsigned int magazine_size;
+
+	/* Buffers reuse policy */
+	enum vbuf_pool_policy policy;
+
+	/* Size classes count (0 if none, at most VBUF_POOL_MAX_CLASSES):
+	 * when not null, the pool is made of one pool per size class,
+	 * with the class capacity and counts and the other members of this
+	 * configuration (count, max_count and capacity are then ignored);
+	 * see vbuf_pool_get_sized() */
+	unsigned int class_count;
+
+	/* Size classes, by strictly increasing capacity (see
+	 * vbuf_pool_classes_layout()) */
+	struct vbuf_pool_class classes[VBUF_POOL_MAX_CLASSES];
+
+	/* Size classes statistics: when not null, requests are counted per
+	 * class (see vbuf_pool_get_class_stats()) */
+	int class_stats;
+};
+
+
 /**
  * Buffer API
  */
@@ -189,6 +376,30 @@ VBUF_API int vbuf_new(size_t capacity,
 		      struct vbuf_buffer **ret_obj);
 
 
+/**
+ * Create a buffer using a single memory allocation.
+ * This function is similar to vbuf_new(), but the buffer object, the user
+ * data and, if the VBUF_NEW_INLINE_PAYLOAD flag is set, the buffer memory
+ * are allocated in a single cache line aligned memory block. The buffer
+ * creation and destruction then cost a single malloc/free. The buffer
+ * memory is not initialized.
+ * Such buffers do not belong to a pool; when no longer needed, the buffer
+ * must be unreferenced using the vbuf_unref() function.
+ * The created buffer object is returned through the ret_obj parameter.
+ * @param capacity: buffer capacity (can be 0 and reallocated later)
+ * @param userdata_capacity: user data buffer capacity (can be 0)
+ * @param cbs: buffer callback functions and user data
+ * @param flags: buffer creation flags (VBUF_NEW_* values, can be 0)
+ * @param ret_obj: pointer to the created buffer object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_new_single(size_t capacity,
+			     size_t userdata_capacity,
+			     const struct vbuf_cbs *cbs,
+			     unsigned int flags,
+			     struct vbuf_buffer **ret_obj);
+
+
 /**
  * Reference a buffer.
  * This function increments the reference counter of a buffer.
@@ -209,9 +420,80 @@ VBUF_API int vbuf_ref(struct vbuf_buffer *buf);
 VBUF_API int vbuf_unref(struct vbuf_buffer *buf);
 
 
+/**
+ * Reference a buffer several times.
+ * This function increments the reference counter of a buffer by count,
+ * with a single atomic operation.
+ * @param buf: pointer on a buffer object
+ * @param count: number of references to take
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_ref_n(struct vbuf_buffer *buf, unsigned int count);
+
+
+/**
+ * Unreference a buffer several times.
+ * This function decrements the reference counter of a buffer by count,
+ * with a single atomic operation (see vbuf_unref()).
+ * @param buf: pointer on a buffer object
+ * @param count: number of references to release
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_unref_n(struct vbuf_buffer *buf, unsigned int count);
+
+
+/**
+ * Enable or disable the deferred release of a buffer.
+ * When the deferred release is enabled and the buffer is no longer
+ * referenced, instead of being released (unref callback function, then
+ * either returned to its pool or destroyed) in the thread that dropped the
+ * last reference, the buffer is handed over to an internal reclaimer
+ * thread that releases buffers in batches. The release is then
+ * asynchronous: for example a buffer may not be available from its pool
+ * immediately after its last reference is dropped. The setting is kept
+ * when the buffer is returned to its pool.
+ * @param buf: pointer on a buffer object
+ * @param enable: deferred release enabled if not null
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_set_deferred_release(struct vbuf_buffer *buf, int enable);
+
+
+/**
+ * Reference a buffer from its owner thread.
+ * The thread that creates a buffer or gets it from a pool is its owner
+ * thread until the buffer is no longer referenced, and the reference it
+ * gets is its first local reference. Local references taken by the owner
+ * thread are counted without atomic operations and together hold a single
+ * reference on the buffer; local references taken by other threads are
+ * regular references (see vbuf_ref()). The references released by the
+ * owner thread (using either vbuf_unref() or vbuf_unref_local()) release
+ * its local references first.
+ * A local reference must be released by the same thread. To hand a buffer
+ * over to another thread, a regular reference must be used; the owner
+ * thread reference can also be handed over (for example using
+ * vbuf_queue_push_move()), but only if the owner thread holds no other
+ * local reference on the buffer.
+ * @param buf: pointer on a buffer object
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_ref_local(struct vbuf_buffer *buf);
+
+
+/**
+ * Unreference a buffer from the thread that took the local reference.
+ * See vbuf_ref_local() and vbuf_unref().
+ * @param buf: pointer on a buffer object
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_unref_local(struct vbuf_buffer *buf);
+
+
 /**
  * Get the buffer's reference count.
- * This function returns the current value of the reference counter.
+ * This function returns the current value of the reference counter,
+ * including the local references (see vbuf_ref_local()); the local
+ * references count is only exact when called from the owner thread.
  * @param buf: pointer on a buffer object
  * @return the reference count on success, negative errno value in case of error
  */
@@ -259,7 +541,9 @@ VBUF_API struct vbuf_pool *vbuf_get_pool(struct vbuf_buffer *buf);
 
 /**
  * Get the buffer's data pointer (read/write).
- * This function fails if the buffer is write-locked.
+ * This function fails if the buffer is write-locked. If the buffer is a
+ * clone or a slice that shares its payload memory, a private copy is made
+ * first (see vbuf_clone() and vbuf_slice()).
  * @param buf: pointer on a buffer object
  * @return the data pointer on success, NULL in case of error
  */
@@ -312,11 +596,73 @@ VBUF_API ssize_t vbuf_get_size(struct vbuf_buffer *buf);
 VBUF_API int vbuf_set_size(struct vbuf_buffer *buf, size_t size);
 
 
+/**
+ * Compute a planar payload layout.
+ * This function fills the planes array with consecutive planes whose rows
+ * of widths[i] bytes are padded to a stride multiple of align, and whose
+ * offsets are multiples of align. The returned size is the buffer
+ * capacity required for all planes.
+ * @param count: planes count (up to VBUF_MAX_PLANES)
+ * @param widths: planes row sizes in bytes
+ * @param heights: planes rows counts
+ * @param align: planes alignment in bytes (power of 2, 0 or 1 if none)
+ * @param planes: pointer on a planes descriptor array of count entries
+ *                (output)
+ * @return the required payload size on success, negative errno value in
+ *         case of error
+ */
+VBUF_API ssize_t vbuf_planes_layout(unsigned int count,
+				    const size_t *widths,
+				    const size_t *heights,
+				    size_t align,
+				    struct vbuf_plane *planes);
+
+
+/**
+ * Set the buffer payload planes descriptors.
+ * Every plane must lie within the buffer capacity and its start address
+ * and stride must be multiples of its alignment. A count of 0 removes all
+ * planes descriptors. The planes descriptors are copied by vbuf_copy() and
+ * vbuf_clone(); when the buffer is returned to its pool, they are reset to
+ * the pool ones (see struct vbuf_pool_config).
+ * This function fails if the buffer is write-locked.
+ * @param buf: pointer on a buffer object
+ * @param planes: pointer on a planes descriptor array of count entries
+ * @param count: planes count (up to VBUF_MAX_PLANES)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_set_planes(struct vbuf_buffer *buf,
+			     const struct vbuf_plane *planes,
+			     unsigned int count);
+
+
+/**
+ * Get the buffer payload planes count.
+ * @param buf: pointer on a buffer object
+ * @return the planes count on success (0 if the payload has no planes
+ *         descriptors), negative errno value in case of error
+ */
+VBUF_API int vbuf_get_plane_count(struct vbuf_buffer *buf);
+
+
+/**
+ * Get a buffer payload plane descriptor.
+ * @param buf: pointer on a buffer object
+ * @param index: plane index
+ * @param plane: pointer on the plane descriptor (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_get_plane(struct vbuf_buffer *buf,
+			    unsigned int index,
+			    struct vbuf_plane *plane);
+
+
 /**
  * Copy a buffer.
  * This function copies the buffer data along with the metadata and user data
  * if available. The destination buffer will be reallocated to an increased
- * capacity if needed.
+ * capacity if needed. The source buffer payload segments are gathered in
+ * the destination buffer payload (see vbuf_append_segment()).
  * @param src_buf: pointer on the source buffer object
  * @param dst_buf: pointer on the destination buffer object
  * @return 0 on success, negative errno value in case of error
@@ -325,6 +671,264 @@ VBUF_API int vbuf_copy(struct vbuf_buffer *src_buf,
 		       struct vbuf_buffer *dst_buf);
 
 
+/**
+ * Copy a buffer asynchronously.
+ * This function performs the same copy as vbuf_copy(), but the payload is
+ * copied by internal worker threads, split in chunks across them. The
+ * metadata, user data and planes are copied before the function returns.
+ * The source buffer must be write-locked. The destination buffer is
+ * write-locked until the copy is complete, and both buffers stay
+ * referenced until then. The completion is notified through the cb
+ * callback function, called from a worker thread; to get the notification
+ * in a pomp loop, the callback function can for example signal a pomp_evt.
+ * @param src_buf: pointer on the source buffer object
+ * @param dst_buf: pointer on the destination buffer object
+ * @param cb: completion callback function (optional, can be NULL)
+ * @param userdata: completion callback function user data pointer
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_copy_async(struct vbuf_buffer *src_buf,
+			     struct vbuf_buffer *dst_buf,
+			     vbuf_copy_cb_t cb,
+			     void *userdata);
+
+
+/**
+ * Copy a 2D region of a buffer payload.
+ * This function copies height rows of width bytes from the source buffer
+ * payload, starting at src_offset with rows separated by src_stride
+ * bytes, to the destination buffer payload, starting at dst_offset with
+ * rows separated by dst_stride bytes. This can be used to crop a frame
+ * (using the plane descriptors to compute the offsets, see
+ * vbuf_get_plane()) or to copy it in a larger frame. Large copies are
+ * split by rows across internal worker threads.
+ * The source region must be within the source buffer size and the
+ * destination region within the destination buffer capacity; the
+ * destination buffer size is increased to the end of the region if
+ * needed. Only the payload is copied, not the metadata and user data.
+ * This function fails if the destination buffer is write-locked.
+ * @param src_buf: pointer on the source buffer object
+ * @param src_offset: source region offset in bytes
+ * @param src_stride: source region stride in bytes
+ * @param dst_buf: pointer on the destination buffer object
+ * @param dst_offset: destination region offset in bytes
+ * @param dst_stride: destination region stride in bytes
+ * @param width: region width in bytes
+ * @param height: region height in rows
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_copy_rect(struct vbuf_buffer *src_buf,
+			    size_t src_offset,
+			    size_t src_stride,
+			    struct vbuf_buffer *dst_buf,
+			    size_t dst_offset,
+			    size_t dst_stride,
+			    size_t width,
+			    size_t height);
+
+
+/**
+ * Enable or disable the dirty tracking of a buffer.
+ * With dirty tracking enabled, the buffer payload is divided in tiles of
+ * tile_size bytes; writers mark the modified regions using
+ * vbuf_mark_dirty() or vbuf_mark_plane_dirty(), and vbuf_copy_dirty()
+ * only copies the tiles modified since the previous copy. When enabled,
+ * all tiles are initially dirty; tiles added by increasing the buffer
+ * capacity or size, and the regions written by the copy functions of this
+ * library (e.g. vbuf_copy_rect()), are dirty too. The dirty tracking state
+ * must not be accessed concurrently from several threads.
+ * @param buf: pointer on a buffer object
+ * @param tile_size: tile size in bytes (power of 2), 0 to disable
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_set_dirty_tracking(struct vbuf_buffer *buf,
+				     size_t tile_size);
+
+
+/**
+ * Mark a region of the buffer payload as modified.
+ * The region must be within the buffer capacity. This function does
+ * nothing if the buffer dirty tracking is disabled.
+ * This function fails if the buffer is write-locked.
+ * @param buf: pointer on a buffer object
+ * @param offset: region offset in the buffer payload in bytes
+ * @param len: region size in bytes
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int
+vbuf_mark_dirty(struct vbuf_buffer *buf, size_t offset, size_t len);
+
+
+/**
+ * Mark a rectangle of a buffer payload plane as modified.
+ * See vbuf_mark_dirty() and vbuf_set_planes().
+ * @param buf: pointer on a buffer object
+ * @param index: plane index
+ * @param x: rectangle horizontal position in bytes
+ * @param y: rectangle vertical position in rows
+ * @param width: rectangle width in bytes
+ * @param height: rectangle height in rows
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_mark_plane_dirty(struct vbuf_buffer *buf,
+				   unsigned int index,
+				   size_t x,
+				   size_t y,
+				   size_t width,
+				   size_t height);
+
+
+/**
+ * Copy the modified regions of a buffer.
+ * This function performs the same copy as vbuf_copy(), but only the
+ * payload tiles marked as dirty in the source buffer are copied; the
+ * destination buffer must hold the result of the previous
+ * vbuf_copy_dirty() of the source buffer (for example a destination buffer
+ * that is always the same). The metadata and user data are always copied,
+ * replacing the ones of the previous copy in the destination buffer.
+ * The source buffer dirty tiles are then cleared.
+ * A full copy is performed if the source buffer dirty tracking is
+ * disabled, if it has payload segments, or if the destination buffer is
+ * not the last one the source buffer was copied to with this function or
+ * was modified by this library since (copies, size increase, buffer
+ * returned to its pool). Modifications of the destination buffer made
+ * through vbuf_get_data() are not detected: they must be recorded using
+ * vbuf_mark_dirty(), so that the next copy is a full copy.
+ * @param src_buf: pointer on the source buffer object
+ * @param dst_buf: pointer on the destination buffer object
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_copy_dirty(struct vbuf_buffer *src_buf,
+			     struct vbuf_buffer *dst_buf);
+
+
+/**
+ * Clone a buffer.
+ * This function creates a new buffer object that shares the payload memory
+ * of the source buffer instead of copying it; the metadata and user data
+ * are copied (see vbuf_metadata_copy()) and the payload segments are
+ * shared (see vbuf_append_segment()). The source buffer must be
+ * write-locked, and it stays referenced until the clone is destroyed or
+ * gets a private copy of the payload: a private copy is made the first
+ * time vbuf_get_data() is called on the clone or when the clone capacity
+ * is increased. Reading the clone data through vbuf_get_cdata() never
+ * copies it.
+ * The clone does not belong to a pool; when no longer needed, it must be
+ * unreferenced using the vbuf_unref() function.
+ * The created buffer object is returned through the ret_obj parameter.
+ * @param src_buf: pointer on the source buffer object
+ * @param ret_obj: pointer to the created buffer object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_clone(struct vbuf_buffer *src_buf,
+			struct vbuf_buffer **ret_obj);
+
+
+/**
+ * Create a slice of a buffer.
+ * This function creates a new buffer object whose payload is the range of
+ * len bytes starting at offset in the source buffer own payload (not
+ * including its segments), without copying it. The range must be within
+ * the source buffer size. The slice
+ * has its own (initially empty) metadata and user data, with a user data
+ * capacity of userdata_capacity. As for vbuf_clone(), the source buffer
+ * must be write-locked and stays referenced until the slice is destroyed
+ * or gets a private copy of the payload through vbuf_get_data().
+ * Slices can themselves be sliced or cloned.
+ * The slice does not belong to a pool; when no longer needed, it must be
+ * unreferenced using the vbuf_unref() function.
+ * The created buffer object is returned through the ret_obj parameter.
+ * @param src_buf: pointer on the source buffer object
+ * @param offset: offset of the slice in the source buffer payload
+ * @param len: slice size in bytes
+ * @param userdata_capacity: user data buffer initial capacity in bytes
+ * @param ret_obj: pointer to the created buffer object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_slice(struct vbuf_buffer *src_buf,
+			size_t offset,
+			size_t len,
+			size_t userdata_capacity,
+			struct vbuf_buffer **ret_obj);
+
+
+/**
+ * Append a payload segment to a buffer.
+ * A buffer payload is made of a chain of segments: the prepended segments,
+ * the buffer own payload (see vbuf_get_size()) and the appended segments.
+ * This function appends a segment that references the range of len bytes
+ * starting at offset in the seg_buf payload, without copying it. Only the
+ * seg_buf own payload is referenced, not its segments. The seg_buf buffer
+ * must be write-locked and stays referenced until the segment is released,
+ * which happens when the buffer is no longer referenced.
+ * This function fails if the buffer is write-locked.
+ * @param buf: pointer on a buffer object
+ * @param seg_buf: pointer on the segment buffer object
+ * @param offset: offset of the segment in the seg_buf payload
+ * @param len: segment size in bytes (must not be null)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_append_segment(struct vbuf_buffer *buf,
+				 struct vbuf_buffer *seg_buf,
+				 size_t offset,
+				 size_t len);
+
+
+/**
+ * Prepend a payload segment to a buffer.
+ * See vbuf_append_segment() for details; the segment is inserted before
+ * all the buffer payload segments.
+ * @param buf: pointer on a buffer object
+ * @param seg_buf: pointer on the segment buffer object
+ * @param offset: offset of the segment in the seg_buf payload
+ * @param len: segment size in bytes (must not be null)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_prepend_segment(struct vbuf_buffer *buf,
+				  struct vbuf_buffer *seg_buf,
+				  size_t offset,
+				  size_t len);
+
+
+/**
+ * Get the buffer payload segments count.
+ * The count includes the buffer own payload if its size is not null; this
+ * is the number of entries filled by vbuf_get_iovec().
+ * @param buf: pointer on a buffer object
+ * @return the segments count on success, negative errno value in case of
+ *         error
+ */
+VBUF_API int vbuf_get_segment_count(struct vbuf_buffer *buf);
+
+
+/**
+ * Get the buffer total payload size.
+ * The total size is the sum of the buffer own payload size and of the
+ * sizes of all its payload segments.
+ * @param buf: pointer on a buffer object
+ * @return the buffer total size on success, negative errno value in case
+ *         of error
+ */
+VBUF_API ssize_t vbuf_get_total_size(struct vbuf_buffer *buf);
+
+
+/**
+ * Get the buffer payload segments as an iovec array.
+ * The array can be used directly with writev() or sendmsg(). The memory
+ * referenced by the array must only be read and is valid as long as the
+ * buffer is referenced. The iov array must have at least
+ * vbuf_get_segment_count() entries.
+ * @param buf: pointer on a buffer object
+ * @param iov: pointer on an iovec array (output)
+ * @param iovcnt: iov array entries count
+ * @return the number of entries filled on success, negative errno value in
+ *         case of error (-ENOBUFS if the array is too small)
+ */
+VBUF_API int vbuf_get_iovec(struct vbuf_buffer *buf,
+			    struct iovec *iov,
+			    unsigned int iovcnt);
+
+
 /**
  * Get the buffer's user data pointer (read/write).
  * If no user data buffer is allocated yet, NULL is returned.
@@ -422,9 +1026,12 @@ VBUF_API int vbuf_metadata_add(struct vbuf_buffer *buf,
 
 
 /**
- * Get the metadata from a buffer.
+ * Get the metadata from a buffer (read/write).
  * This function gets the metadata associated with a key and optionally
  * outputs the metadata level and size.
+ * If the metadata data is shared with other buffers (see
+ * vbuf_metadata_copy()), a private copy is made first. When write access
+ * is not needed, the vbuf_metadata_cget() function should be used instead.
  * @param buf: pointer on a buffer object
  * @param key: metadata key
  * @param level: optional pointer on the metadata level (output)
@@ -439,6 +1046,27 @@ VBUF_API int vbuf_metadata_get(struct vbuf_buffer *buf,
 			       uint8_t **ret_ptr);
 
 
+/**
+ * Get the metadata from a buffer (read only).
+ * This function gets the metadata associated with a key and optionally
+ * outputs the metadata level and size. Unlike vbuf_metadata_get(), the
+ * metadata data is never copied; it must not be modified. The returned
+ * pointer remains valid until the metadata is removed or the buffer is
+ * released, even if a private copy is made in the meantime.
+ * @param buf: pointer on a buffer object
+ * @param key: metadata key
+ * @param level: optional pointer on the metadata level (output)
+ * @param len: optional pointer on the metadata size (output)
+ * @param ret_ptr: pointer to the metadata (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_metadata_cget(struct vbuf_buffer *buf,
+				void *key,
+				unsigned int *level,
+				size_t *len,
+				const uint8_t **ret_ptr);
+
+
 /**
  * Remove the metadata from a buffer.
  * This function removes the metadata associated with a key and frees the
@@ -456,6 +1084,12 @@ VBUF_API int vbuf_metadata_remove(struct vbuf_buffer *buf, void *key);
  * metadata. If the max_level parameter is 0, all metadata from the source
  * buffer is copied to the destination buffer, otherwise only the metadata
  * with a level up to max_level (excluded) is copied.
+ * The metadata data is not actually copied but moved to a reference counted
+ * data block shared between the source and destination buffers, which is
+ * independent of the buffers lifetime: a private copy is only made when a
+ * writable pointer is requested on either buffer through
+ * vbuf_metadata_get(). Pointers previously obtained on the source buffer
+ * metadata must therefore no longer be used for writing.
  * @param src_buf: pointer on the source buffer object
  * @param dst_buf: pointer on the destination buffer object
  * @param max_level: maximum level (excluded) of metadata to copy
@@ -472,7 +1106,8 @@ VBUF_API int vbuf_metadata_copy(struct vbuf_buffer *src_buf,
 
 /**
  * Create a buffer pool.
- * The pool buffer count is mandatory and cannot be updated later.
+ * The pool buffer count is mandatory and cannot be updated later (see
+ * vbuf_pool_new_ext() for elastic pools).
  * The capacity and userdata_capacity parameters are optional and can be 0,
  * then the memory can be reallocated later if realloc is supported in the
  * underlying buffer implementation. At least the alloc and free callbacks
@@ -494,11 +1129,30 @@ VBUF_API int vbuf_pool_new(unsigned int count,
 			   struct vbuf_pool **ret_obj);
 
 
+/**
+ * Create a buffer pool from a configuration structure.
+ * This function is similar to vbuf_pool_new() but allows setting
+ * additional pool options through the config parameter (see
+ * struct vbuf_pool_config).
+ * When no longer needed, the pool must be freed using the vbuf_pool_destroy()
+ * function.
+ * The created buffer pool object is returned through the ret_obj parameter.
+ * @param config: pool configuration
+ * @param cbs: buffer callback functions and user data
+ * @param ret_obj: pointer to the created buffer pool object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_pool_new_ext(const struct vbuf_pool_config *config,
+			       const struct vbuf_cbs *cbs,
+			       struct vbuf_pool **ret_obj);
+
+
 /**
  * Destroy a buffer pool.
  * This function destroys a buffer pool and frees the associated buffers.
  * All buffers should have been previoulsy unreferenced and returned to
- * the pool.
+ * the pool. If the pool buffers deferred release is enabled, the function
+ * first waits for the buffers being returned by the reclaimer thread.
  * @param pool: pointer on a buffer pool object
  * @return 0 on success, negative errno value in case of error
  */
@@ -514,16 +1168,79 @@ VBUF_API int vbuf_pool_destroy(struct vbuf_pool *pool);
 VBUF_API int vbuf_pool_get_count(struct vbuf_pool *pool);
 
 
+/**
+ * Compute geometric pool size classes.
+ * This function fills the classes array with size classes whose capacity
+ * doubles from min_capacity, the last class capacity being max_capacity,
+ * each with count buffers (the classes counts can be adjusted afterwards).
+ * @param min_capacity: smallest class capacity
+ * @param max_capacity: largest class capacity
+ * @param count: buffer count of each class
+ * @param classes: pointer on a size classes array of VBUF_POOL_MAX_CLASSES
+ *                 entries (output)
+ * @return the size classes count on success, negative errno value in case
+ *         of error (-EINVAL if more than VBUF_POOL_MAX_CLASSES classes are
+ *         needed)
+ */
+VBUF_API int vbuf_pool_classes_layout(size_t min_capacity,
+				      size_t max_capacity,
+				      unsigned int count,
+				      struct vbuf_pool_class *classes);
+
+
+/**
+ * Get the pool size classes count.
+ * A pool created without size classes is reported as a single class.
+ * @param pool: pointer on a buffer pool object
+ * @return the size classes count on success, negative errno value in case
+ *         of error
+ */
+VBUF_API int vbuf_pool_get_class_count(struct vbuf_pool *pool);
+
+
+/**
+ * Get the statistics of a pool size class.
+ * The request counters are only updated if enabled in the pool
+ * configuration (see struct vbuf_pool_config).
+ * @param pool: pointer on a buffer pool object
+ * @param index: size class index (see vbuf_pool_get_class_count())
+ * @param stats: pointer on the statistics structure to fill (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_pool_get_class_stats(struct vbuf_pool *pool,
+				       unsigned int index,
+				       struct vbuf_pool_class_stats *stats);
+
+
+/**
+ * Release the idle buffers of an elastic pool.
+ * This function destroys the free buffers of the pool that have been idle
+ * for at least the pool idle timeout (or all free buffers if the timeout
+ * is 0), keeping at least the pool minimum buffer count. Pools with an
+ * idle timeout are also trimmed periodically in the background, so
+ * calling this function is only needed to release memory immediately.
+ * A vbuf_pool_get() call concurrent with a trim may find no free buffer
+ * and allocate a new one, growing the pool while it is being trimmed.
+ * @param pool: pointer on a buffer pool object
+ * @return the number of released buffers on success,
+ *         negative errno value in case of error
+ */
+VBUF_API int vbuf_pool_trim(struct vbuf_pool *pool);
+
+
 /**
  * Get a buffer from the pool.
- * This function outputs a buffer from the pool, increasing its reference
- * count to 1.
- * If no buffer is currently available, the function waits up to timeout_ms
- * milliseconds for a buffer to become available. If timeout_ms is 0, the
- * function returns immediately with a -EAGAIN error. If waiting timed out
- * and still no buffer is available, a -ETIMEDOUT error is returned. If
- * timeout_ms is negative, the function waits forever for a buffer to become
- * available (or until vbuf_pool_abort() is called).
+ * This function outputs a buffer from the pool, setting its reference
+ * count to 1; the caller owns this reference (setting it does not require
+ * an atomic read-modify-write operation).
+ * If no buffer is currently available, a new buffer is allocated for
+ * elastic pools below their maximum count; otherwise the function waits up
+ * to timeout_ms milliseconds for a buffer to become available. If
+ * timeout_ms is 0, the function returns immediately with a -EAGAIN error.
+ * If waiting timed out and still no buffer is available, a -ETIMEDOUT
+ * error is returned. If timeout_ms is negative, the function waits forever
+ * for a buffer to become available (or until vbuf_pool_abort() is
+ * called).
  * On success the buffer is returned in the value pointed by the buf parameter.
  * @param pool: pointer on a buffer pool object
  * @param timeout_ms: timeout in milliseconds (0 means no wait,
@@ -535,6 +1252,30 @@ VBUF_API int
 vbuf_pool_get(struct vbuf_pool *pool, int timeout_ms, struct vbuf_buffer **buf);
 
 
+/**
+ * Get a buffer of a minimum capacity from the pool.
+ * This function is similar to vbuf_pool_get(), but outputs a buffer from
+ * the smallest pool size class whose capacity is at least min_capacity.
+ * If no buffer of that class is available (and the class cannot grow),
+ * a buffer of a larger class is output if one is available; otherwise
+ * the function waits for a buffer of the smallest class as described for
+ * vbuf_pool_get(). If the capacity of the largest class (or of a pool
+ * without size classes) is less than min_capacity, a -ENOBUFS error is
+ * returned. For pools with size classes, vbuf_pool_get() outputs a buffer
+ * of the smallest class.
+ * @param pool: pointer on a buffer pool object
+ * @param min_capacity: minimum buffer capacity
+ * @param timeout_ms: timeout in milliseconds (0 means no wait,
+ *                    negative value means wait forever)
+ * @param buf: pointer on a buffer object pointer (output)
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_pool_get_sized(struct vbuf_pool *pool,
+				 size_t min_capacity,
+				 int timeout_ms,
+				 struct vbuf_buffer **buf);
+
+
 /**
  * Abort waiting for a buffer.
  * This function aborts any wait in progress in a vbuf_pool_get() call,
@@ -550,6 +1291,10 @@ VBUF_API int vbuf_pool_abort(struct vbuf_pool *pool);
  * This function returns the pomp_evt associated with the pool.
  * This is useful to be notified in a pomp_loop that a buffer is available
  * in the pool.
+ * With a lock-free free list or per-CPU caches, the event is only
+ * signaled when buffers are returned to an empty free list or cache:
+ * when notified, buffers should be taken until vbuf_pool_get() returns
+ * -EAGAIN.
  * @param pool: pointer on a buffer pool object
  * @return a pointer on the pomp_evt object on success, NULL in case of error
  */
@@ -636,7 +1381,9 @@ VBUF_API int vbuf_queue_peek(struct vbuf_queue *queue,
  * This function outputs a buffer from the queue. The reference count is
  * unchanged, but since the reference count was incremented by 1 when the
  * buffer was pushed in the queue, the buffer must be unreferenced once no
- * longer needed.
+ * longer needed: the queue reference is moved to the caller. Together with
+ * vbuf_queue_push_move(), buffers can go through queues without any
+ * reference count update.
  * If no buffer is currently available, the function waits up to timeout_ms
  * milliseconds for a buffer to become available. If timeout_ms is 0, the
  * function returns immediately with a -EAGAIN error. If waiting timed out
@@ -670,6 +1417,39 @@ VBUF_API int vbuf_queue_pop(struct vbuf_queue *queue,
 VBUF_API int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf);
 
 
+/**
+ * Push a buffer into the queue, moving the caller's reference.
+ * This function is identical to vbuf_queue_push(), except that the
+ * reference count is unchanged: on success the caller's reference is
+ * transferred to the queue, and the caller must no longer use or
+ * unreference the buffer. On failure, the caller keeps its reference.
+ * This is equivalent to a vbuf_queue_push() followed by a vbuf_unref()
+ * without the two reference count updates.
+ * @param queue: pointer on a buffer queue object
+ * @param buf: pointer on a buffer object
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_queue_push_move(struct vbuf_queue *queue,
+				  struct vbuf_buffer *buf);
+
+
+/**
+ * Push a buffer into several queues.
+ * This function pushes a buffer into each of the count queues of the
+ * queues array; the references for all queues are taken with a single
+ * reference count update (see vbuf_ref_n() and vbuf_queue_push_move()).
+ * The buffer is pushed into all queues even if pushing into one of them
+ * fails, in which case the error of the last failure is returned.
+ * @param queues: array of pointers on buffer queue objects
+ * @param count: queues array entries count
+ * @param buf: pointer on a buffer object
+ * @return 0 on success, negative errno value in case of error
+ */
+VBUF_API int vbuf_queue_push_fanout(struct vbuf_queue **queues,
+				    unsigned int count,
+				    struct vbuf_buffer *buf);
+
+
 /**
  * Abort waiting for a buffer.
  * This function aborts any wait in progress in a vbuf_queue_peek() or
@@ -704,4 +1484,11 @@ VBUF_API struct pomp_evt *vbuf_queue_get_evt(struct vbuf_queue *queue);
 }
 #endif /* __cplusplus */
 
+
+/* Opt-in inline accessors (see vbuf_inline.h); never used by the library
+ * itself, which only exports the out-of-line functions */
+#if defined(VBUF_INLINE_ACCESSORS) && !defined(VBUF_API_EXPORTS)
+#	include "vbuf_inline.h"
+#endif
+
 #endif /* !_VBUF_H_ */
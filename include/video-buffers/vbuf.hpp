@@ -0,0 +1,394 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VBUF_HPP_
+#define _VBUF_HPP_
+
+/**
+ * C++ wrappers.
+ *
+ * Header-only owning handles over the C API objects. Buffer handles are
+ * move-only: a move transfers the reference without touching the
+ * reference count, and a new reference is only taken explicitly with
+ * Buffer::clone_ref(). Errors are reported as in the C API, with negative
+ * errno values.
+ */
+
+#include <utility>
+
+#include "vbuf.h"
+
+namespace vbuf {
+
+
+/* Owning handle on a buffer reference */
+class Buffer {
+public:
+	Buffer() noexcept : mBuf(nullptr) {}
+
+	/* Adopt an existing reference (the reference count is unchanged) */
+	explicit Buffer(struct vbuf_buffer *buf) noexcept : mBuf(buf) {}
+
+	Buffer(Buffer &&other) noexcept : mBuf(other.release()) {}
+
+	Buffer &operator=(Buffer &&other) noexcept
+	{
+		if (this != &other)
+			reset(other.release());
+		return *this;
+	}
+
+	Buffer(const Buffer &) = delete;
+	Buffer &operator=(const Buffer &) = delete;
+
+	~Buffer()
+	{
+		reset();
+	}
+
+	/* Create a buffer (see vbuf_new()) */
+	static int create(size_t capacity,
+			  size_t userdata_capacity,
+			  const struct vbuf_cbs *cbs,
+			  Buffer &ret)
+	{
+		struct vbuf_buffer *buf = nullptr;
+		int res = vbuf_new(capacity, userdata_capacity, cbs, nullptr, &buf);
+		if (res == 0)
+			ret.reset(buf);
+		return res;
+	}
+
+	/* Take a new reference on a buffer */
+	static Buffer ref(struct vbuf_buffer *buf) noexcept
+	{
+		if (buf != nullptr)
+			vbuf_ref(buf);
+		return Buffer(buf);
+	}
+
+	/* Take a new reference on the same buffer */
+	Buffer clone_ref() const noexcept
+	{
+		return ref(mBuf);
+	}
+
+	/* Release the reference held by the handle, if any, and optionally
+	 * adopt a new one */
+	void reset(struct vbuf_buffer *buf = nullptr) noexcept
+	{
+		struct vbuf_buffer *old = mBuf;
+		mBuf = buf;
+		if (old != nullptr)
+			vbuf_unref(old);
+	}
+
+	/* Give up the reference without releasing it; the caller becomes
+	 * responsible for it */
+	struct vbuf_buffer *release() noexcept
+	{
+		struct vbuf_buffer *buf = mBuf;
+		mBuf = nullptr;
+		return buf;
+	}
+
+	struct vbuf_buffer *get() const noexcept
+	{
+		return mBuf;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return mBuf != nullptr;
+	}
+
+	const uint8_t *cdata() const
+	{
+		return vbuf_get_cdata(mBuf);
+	}
+
+	uint8_t *data()
+	{
+		return vbuf_get_data(mBuf);
+	}
+
+	ssize_t capacity() const
+	{
+		return vbuf_get_capacity(mBuf);
+	}
+
+	ssize_t size() const
+	{
+		return vbuf_get_size(mBuf);
+	}
+
+	int set_size(size_t size)
+	{
+		return vbuf_set_size(mBuf, size);
+	}
+
+	int write_lock()
+	{
+		return vbuf_write_lock(mBuf);
+	}
+
+	int write_unlock()
+	{
+		return vbuf_write_unlock(mBuf);
+	}
+
+private:
+	struct vbuf_buffer *mBuf;
+};
+
+
+/* Owning handle on a buffer pool */
+class Pool {
+public:
+	Pool() noexcept : mPool(nullptr) {}
+
+	/* Adopt an existing pool */
+	explicit Pool(struct vbuf_pool *pool) noexcept : mPool(pool) {}
+
+	Pool(Pool &&other) noexcept : mPool(other.release()) {}
+
+	Pool &operator=(Pool &&other) noexcept
+	{
+		if (this != &other)
+			reset(other.release());
+		return *this;
+	}
+
+	Pool(const Pool &) = delete;
+	Pool &operator=(const Pool &) = delete;
+
+	~Pool()
+	{
+		reset();
+	}
+
+	/* Create a buffer pool (see vbuf_pool_new_ext()) */
+	static int create(const struct vbuf_pool_config *config,
+			  const struct vbuf_cbs *cbs,
+			  Pool &ret)
+	{
+		struct vbuf_pool *pool = nullptr;
+		int res = vbuf_pool_new_ext(config, cbs, &pool);
+		if (res == 0)
+			ret.reset(pool);
+		return res;
+	}
+
+	/* Destroy the pool, if any, and optionally adopt a new one */
+	void reset(struct vbuf_pool *pool = nullptr) noexcept
+	{
+		struct vbuf_pool *old = mPool;
+		mPool = pool;
+		if (old != nullptr)
+			vbuf_pool_destroy(old);
+	}
+
+	struct vbuf_pool *release() noexcept
+	{
+		struct vbuf_pool *pool = mPool;
+		mPool = nullptr;
+		return pool;
+	}
+
+	struct vbuf_pool *get() const noexcept
+	{
+		return mPool;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return mPool != nullptr;
+	}
+
+	/* Get a buffer from the pool (see vbuf_pool_get()); the reference
+	 * is moved to ret */
+	int get(int timeout_ms, Buffer &ret)
+	{
+		struct vbuf_buffer *buf = nullptr;
+		int res = vbuf_pool_get(mPool, timeout_ms, &buf);
+		if (res == 0)
+			ret.reset(buf);
+		return res;
+	}
+
+	/* Get a buffer of a minimum capacity from the pool (see
+	 * vbuf_pool_get_sized()); the reference is moved to ret */
+	int get_sized(size_t min_capacity, int timeout_ms, Buffer &ret)
+	{
+		struct vbuf_buffer *buf = nullptr;
+		int res = vbuf_pool_get_sized(mPool, min_capacity, timeout_ms, &buf);
+		if (res == 0)
+			ret.reset(buf);
+		return res;
+	}
+
+	int count() const
+	{
+		return vbuf_pool_get_count(mPool);
+	}
+
+	int trim()
+	{
+		return vbuf_pool_trim(mPool);
+	}
+
+	int abort()
+	{
+		return vbuf_pool_abort(mPool);
+	}
+
+	struct pomp_evt *evt() const
+	{
+		return vbuf_pool_get_evt(mPool);
+	}
+
+private:
+	struct vbuf_pool *mPool;
+};
+
+
+/* Owning handle on a buffer queue */
+class Queue {
+public:
+	Queue() noexcept : mQueue(nullptr) {}
+
+	/* Adopt an existing queue */
+	explicit Queue(struct vbuf_queue *queue) noexcept : mQueue(queue) {}
+
+	Queue(Queue &&other) noexcept : mQueue(other.release()) {}
+
+	Queue &operator=(Queue &&other) noexcept
+	{
+		if (this != &other)
+			reset(other.release());
+		return *this;
+	}
+
+	Queue(const Queue &) = delete;
+	Queue &operator=(const Queue &) = delete;
+
+	~Queue()
+	{
+		reset();
+	}
+
+	/* Create a buffer queue (see vbuf_queue_new()) */
+	static int
+	create(unsigned int max_count, int drop_when_full, Queue &ret)
+	{
+		struct vbuf_queue *queue = nullptr;
+		int res = vbuf_queue_new(max_count, drop_when_full, &queue);
+		if (res == 0)
+			ret.reset(queue);
+		return res;
+	}
+
+	/* Destroy the queue, if any, and optionally adopt a new one */
+	void reset(struct vbuf_queue *queue = nullptr) noexcept
+	{
+		struct vbuf_queue *old = mQueue;
+		mQueue = queue;
+		if (old != nullptr)
+			vbuf_queue_destroy(old);
+	}
+
+	struct vbuf_queue *release() noexcept
+	{
+		struct vbuf_queue *queue = mQueue;
+		mQueue = nullptr;
+		return queue;
+	}
+
+	struct vbuf_queue *get() const noexcept
+	{
+		return mQueue;
+	}
+
+	explicit operator bool() const noexcept
+	{
+		return mQueue != nullptr;
+	}
+
+	/* Push a buffer, taking a new reference (see vbuf_queue_push()) */
+	int push(const Buffer &buf)
+	{
+		return vbuf_queue_push(mQueue, buf.get());
+	}
+
+	/* Push a buffer, moving its reference into the queue (see
+	 * vbuf_queue_push_move()); on failure buf keeps its reference */
+	int push(Buffer &&buf)
+	{
+		int res = vbuf_queue_push_move(mQueue, buf.get());
+		if (res == 0)
+			buf.release();
+		return res;
+	}
+
+	/* Get a buffer from the queue (see vbuf_queue_pop()); the queue
+	 * reference is moved to ret */
+	int pop(int timeout_ms, Buffer &ret)
+	{
+		struct vbuf_buffer *buf = nullptr;
+		int res = vbuf_queue_pop(mQueue, timeout_ms, &buf);
+		if (res == 0)
+			ret.reset(buf);
+		return res;
+	}
+
+	int count() const
+	{
+		return vbuf_queue_get_count(mQueue);
+	}
+
+	int flush()
+	{
+		return vbuf_queue_flush(mQueue);
+	}
+
+	int abort()
+	{
+		return vbuf_queue_abort(mQueue);
+	}
+
+	struct pomp_evt *evt() const
+	{
+		return vbuf_queue_get_evt(mQueue);
+	}
+
+private:
+	struct vbuf_queue *mQueue;
+};
+
+
+} /* namespace vbuf */
+
+#endif /* !_VBUF_HPP_ */
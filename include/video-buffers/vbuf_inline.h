@@ -0,0 +1,188 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _VBUF_INLINE_H_
+#define _VBUF_INLINE_H_
+
+/**
+ * Inline accessors.
+ *
+ * When the VBUF_INLINE_ACCESSORS macro is defined before including vbuf.h,
+ * the following functions are replaced by static inline functions that
+ * read the buffer object members directly, without any call into the
+ * library:
+ * vbuf_get_cdata(), vbuf_get_data(), vbuf_get_capacity(), vbuf_get_size(),
+ * vbuf_get_total_size(), vbuf_get_cuserdata(), vbuf_get_userdata(),
+ * vbuf_get_userdata_capacity(), vbuf_get_userdata_size(),
+ * vbuf_is_write_locked(), vbuf_get_pool() and vbuf_get_plane_count().
+ *
+ * The arguments are not validated: they are only checked with assert()
+ * (i.e. in debug builds), and a NULL buffer pointer is not allowed.
+ * vbuf_get_data() and vbuf_get_userdata() still call the library when
+ * they fail or when the data is shared (see vbuf_clone()). The exported
+ * functions are unchanged and can still be called by putting the function
+ * name in parentheses, e.g. (vbuf_get_size)(buf).
+ *
+ * The inline functions depend on the buffer object layout (see
+ * vbuf_private.h, which requires the libfutils headers): code using them
+ * must be rebuilt when the library is updated.
+ */
+
+#include <assert.h>
+
+#include "vbuf_private.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+
+static inline const uint8_t *vbuf_inline_get_cdata(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return buf->ptr;
+}
+
+
+static inline uint8_t *vbuf_inline_get_data(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	/* Error (write-locked) or private copy needed (shared data) */
+	if (buf->write_locked || (buf->parent != NULL))
+		return (vbuf_get_data)(buf);
+
+	return buf->ptr;
+}
+
+
+static inline ssize_t vbuf_inline_get_capacity(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (ssize_t)buf->capacity;
+}
+
+
+static inline ssize_t vbuf_inline_get_size(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (ssize_t)buf->size;
+}
+
+
+static inline ssize_t vbuf_inline_get_total_size(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (ssize_t)(buf->size + buf->segments_size);
+}
+
+
+static inline const uint8_t *
+vbuf_inline_get_cuserdata(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return buf->userdata_ptr;
+}
+
+
+static inline uint8_t *vbuf_inline_get_userdata(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	/* Error (write-locked) */
+	if (buf->write_locked)
+		return (vbuf_get_userdata)(buf);
+
+	return buf->userdata_ptr;
+}
+
+
+static inline ssize_t
+vbuf_inline_get_userdata_capacity(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (ssize_t)buf->userdata_capacity;
+}
+
+
+static inline ssize_t vbuf_inline_get_userdata_size(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (ssize_t)buf->userdata_size;
+}
+
+
+static inline int vbuf_inline_is_write_locked(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return buf->write_locked;
+}
+
+
+static inline struct vbuf_pool *vbuf_inline_get_pool(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return buf->pool;
+}
+
+
+static inline int vbuf_inline_get_plane_count(struct vbuf_buffer *buf)
+{
+	assert(buf != NULL);
+
+	return (int)buf->plane_count;
+}
+
+
+#define vbuf_get_cdata(_buf) vbuf_inline_get_cdata(_buf)
+#define vbuf_get_data(_buf) vbuf_inline_get_data(_buf)
+#define vbuf_get_capacity(_buf) vbuf_inline_get_capacity(_buf)
+#define vbuf_get_size(_buf) vbuf_inline_get_size(_buf)
+#define vbuf_get_total_size(_buf) vbuf_inline_get_total_size(_buf)
+#define vbuf_get_cuserdata(_buf) vbuf_inline_get_cuserdata(_buf)
+#define vbuf_get_userdata(_buf) vbuf_inline_get_userdata(_buf)
+#define vbuf_get_userdata_capacity(_buf)                                       \
+	vbuf_inline_get_userdata_capacity(_buf)
+#define vbuf_get_userdata_size(_buf) vbuf_inline_get_userdata_size(_buf)
+#define vbuf_is_write_locked(_buf) vbuf_inline_is_write_locked(_buf)
+#define vbuf_get_pool(_buf) vbuf_inline_get_pool(_buf)
+#define vbuf_get_plane_count(_buf) vbuf_inline_get_plane_count(_buf)
+
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+#endif /* !_VBUF_INLINE_H_ */
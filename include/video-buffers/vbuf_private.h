@@ -38,33 +38,55 @@ extern "C" {
 #endif /* __cplusplus */
 
 
-/* Forward declaration */
+/* Cache line size used for buffer objects alignment */
+#define VBUF_CACHE_LINE_SIZE 64
+
+
+/* Cache line alignment attribute */
+#if defined(__GNUC__)
+#	define VBUF_CACHE_ALIGNED __attribute__((aligned(VBUF_CACHE_LINE_SIZE)))
+#else
+#	error no alignment attribute found on this platform
+#endif
+
+
+/* Forward declarations */
 struct vbuf_specific;
+struct vbuf_meta_index;
 
 
-/* Buffer object */
+/* Buffer object; the members accessed on every data access (type to ptr)
+ * fit in the first cache line, the metadata members start on a new cache
+ * line and the reference counting members are alone on the last cache
+ * line (checked at build time in vbuf.c); the object size depends on
+ * VBUF_MAX_PLANES and on the platform.
+ * Note for implementations: the callback functions are no longer stored
+ * in the buffer object, the cbs member is a pointer on a read-only table
+ * (buf->cbs->alloc instead of buf->cbs.alloc) */
 struct vbuf_buffer {
+	/* Read-mostly members, accessed on every data access */
+
 	/* Buffer type identifier (must be unique to a buffer implementation) */
 	uint32_t type;
 
-	/* Buffer current reference count */
-	unsigned int ref_count;
-
 	/* True (not null) when the buffer is write-locked */
 	int write_locked;
 
-	/* Node for inclusion in a list */
-	struct list_node node;
-
-	/* Originating pool (optional, can be NULL) */
-	struct vbuf_pool *pool;
+	/* Buffer callback functions (read-only table owned by the pool or
+	 * the implementation, or private copy stored in the buffer object
+	 * memory block) */
+	const struct vbuf_cbs *cbs;
 
-	/* Buffer callback functions */
-	struct vbuf_cbs cbs;
+	/* Buffer owning the payload memory when it is shared with this
+	 * buffer (clones), NULL otherwise */
+	struct vbuf_buffer *parent;
 
 	/* Platform-specific data */
 	struct vbuf_specific *specific;
 
+	/* Originating pool (optional, can be NULL) */
+	struct vbuf_pool *pool;
+
 	/* Video frame buffer capacity */
 	size_t capacity;
 
@@ -74,11 +96,15 @@ struct vbuf_buffer {
 	/* Video frame buffer pointer */
 	uint8_t *ptr;
 
-	/* Metadata mutex */
-	pthread_mutex_t mutex;
+	/* Video frame buffer planes count and descriptors (can be set by
+	 * the alloc callback function) */
+	unsigned int plane_count;
+	struct vbuf_plane planes[VBUF_MAX_PLANES];
 
-	/* Metadata list */
-	struct list_node metas;
+	/* Inline video frame buffer capacity (not null when the ptr memory
+	 * is allocated along with the buffer object, in that case it must
+	 * not be freed by the implementation) */
+	size_t inline_capacity;
 
 	/* User data buffer capacity */
 	size_t userdata_capacity;
@@ -88,6 +114,102 @@ struct vbuf_buffer {
 
 	/* User data buffer pointer */
 	uint8_t *userdata_ptr;
+
+	/* True (not null) when the user data memory is allocated along with
+	 * the buffer object */
+	int userdata_inline;
+
+	/* True (not null) when the buffer is released on the reclaimer
+	 * thread once no longer referenced */
+	int deferred_release;
+
+	/* Next buffer in the reclaimer thread pending buffers stack */
+	struct vbuf_buffer *reclaim_next;
+
+	/* Time (monotonic, in microseconds) when the buffer was last
+	 * returned to its pool (only for pools with an idle timeout) */
+	uint64_t pool_idle_since;
+
+	/* Size class index in the originating pool (only for pools with
+	 * size classes) */
+	unsigned int pool_class;
+
+	/* Node for inclusion in a list */
+	struct list_node node;
+
+	/* Payload segments lists (references on other buffers payload ranges
+	 * that come before and after the buffer own payload, see
+	 * vbuf_prepend_segment() and vbuf_append_segment()) */
+	struct list_node segments_before;
+	struct list_node segments_after;
+
+	/* Payload segments count */
+	unsigned int segment_count;
+
+	/* Total size of the payload segments */
+	size_t segments_size;
+
+	/* Dirty tracking tile size (power of 2, 0 if dirty tracking is
+	 * disabled), tiles count covering the capacity and dirty tiles
+	 * bitmap (see vbuf_set_dirty_tracking()) */
+	size_t dirty_tile_size;
+	size_t dirty_tile_count;
+	uint64_t *dirty_map;
+
+	/* Dirty tracking generations: generation of the last
+	 * vbuf_copy_dirty() from this buffer, and generation of the copy
+	 * this buffer holds as a vbuf_copy_dirty() destination (0 if it
+	 * was modified since) */
+	uint64_t dirty_gen;
+	uint64_t dirty_synced_gen;
+
+	/* Metadata members, on a separate cache line */
+
+	/* Metadata mutex */
+	pthread_mutex_t mutex VBUF_CACHE_ALIGNED;
+
+	/* Metadata list */
+	struct list_node metas;
+
+	/* Metadata list entries count */
+	unsigned int meta_count;
+
+	/* Metadata index (hash table of the metadata list entries) */
+	struct vbuf_meta_index *meta_index;
+
+	/* Metadata index used slots count (including removed entries) */
+	unsigned int meta_index_used;
+
+	/* Metadata sequence number (odd while the metadata is being
+	 * modified, used for lock-free metadata reads) */
+	unsigned int meta_seq;
+
+	/* Retired metadata memory, freed when the buffer is no longer
+	 * referenced (lock-free readers may still be accessing it) */
+	struct vbuf_meta_index *meta_index_retired;
+	struct list_node meta_retired;
+
+	/* Metadata arena pointer (allocated along with the buffer object) */
+	uint8_t *meta_arena;
+
+	/* Metadata arena capacity */
+	size_t meta_arena_capacity;
+
+	/* Metadata arena currently used size */
+	size_t meta_arena_used;
+
+	/* Buffer current reference count; this member is atomically updated
+	 * from any thread and is on its own cache line (with the local
+	 * references members) so that reference counting does not invalidate
+	 * the read-mostly members */
+	unsigned int ref_count VBUF_CACHE_ALIGNED;
+
+	/* Local references owner thread identifier (the thread that created
+	 * the buffer or got it from its pool, 0 if none) and count; all local
+	 * references together hold a single reference in ref_count (see
+	 * vbuf_ref_local()) */
+	uintptr_t local_owner;
+	unsigned int local_ref_count;
 };
 
 
@@ -28,13 +28,138 @@
 ULOG_DECLARE_TAG(vbuf);
 
 
+/* Metadata index removed entry marker */
+static struct vbuf_meta s_meta_removed;
+
+
+/* Last dirty tracking generation (see vbuf_copy_dirty()) */
+static uint64_t s_dirty_gen;
+
+
+/* Local references owner thread identifier: address of a thread-local
+ * variable, unique among running threads */
+static __thread char s_local_thread_id;
+
+
+/* Buffer object layout (see struct vbuf_buffer): the members accessed on
+ * every data access fit in the first cache line, and the reference
+ * counting members are alone on the last cache line */
+_Static_assert(offsetof(struct vbuf_buffer, ptr) + sizeof(uint8_t *) <=
+		       VBUF_CACHE_LINE_SIZE,
+	       "buffer data access members beyond the first cache line");
+_Static_assert(offsetof(struct vbuf_buffer, ref_count) %
+			       VBUF_CACHE_LINE_SIZE ==
+		       0,
+	       "buffer reference count not on its own cache line");
+_Static_assert(sizeof(struct vbuf_buffer) -
+			       offsetof(struct vbuf_buffer, ref_count) <=
+		       VBUF_CACHE_LINE_SIZE,
+	       "buffer reference counting members beyond one cache line");
+
+
+/* Clone alloc callback function: the payload memory is set up by
+ * vbuf_clone() or vbuf_slice() */
+static int vbuf_clone_alloc_cb(struct vbuf_buffer *buf, void *userdata)
+{
+	buf->type = VBUF_TYPE_CLONE;
+	return 0;
+}
+
+
+/* Clone realloc callback function: only called on private memory (see
+ * vbuf_unshare()) */
+static int vbuf_clone_realloc_cb(struct vbuf_buffer *buf, void *userdata)
+{
+	int res;
+	void *ptr = NULL;
+	uint8_t *tmp = realloc(buf->ptr, buf->capacity);
+	if (tmp == NULL)
+		return -ENOMEM;
+	buf->ptr = tmp;
+
+	/* Keep the payload alignment for the planes (see vbuf_set_planes()) */
+	if (((uintptr_t)tmp & (VBUF_CACHE_LINE_SIZE - 1)) != 0) {
+		res = posix_memalign(&ptr, VBUF_CACHE_LINE_SIZE, buf->capacity);
+		if (res != 0)
+			return -res;
+		memcpy(ptr, tmp, buf->capacity);
+		free(tmp);
+		buf->ptr = ptr;
+	}
+
+	return 0;
+}
+
+
+/* Clone free callback function: release either the shared or the private
+ * payload memory */
+static int vbuf_clone_free_cb(struct vbuf_buffer *buf, void *userdata)
+{
+	if (buf->parent != NULL)
+		vbuf_unref(buf->parent);
+	else
+		free(buf->ptr);
+	buf->parent = NULL;
+	buf->ptr = NULL;
+
+	return 0;
+}
+
+
+/* Clone buffers callback functions */
+static const struct vbuf_cbs s_clone_cbs = {
+	.alloc = vbuf_clone_alloc_cb,
+	.realloc = vbuf_clone_realloc_cb,
+	.free = vbuf_clone_free_cb,
+};
+
+
 int vbuf_new(size_t capacity,
 	     size_t userdata_capacity,
 	     const struct vbuf_cbs *cbs,
 	     struct vbuf_pool *pool,
 	     struct vbuf_buffer **ret_obj)
 {
-	int res = 0, err, mutex_init = 0;
+	return vbuf_create(
+		capacity, userdata_capacity, 0, cbs, pool, 0, ret_obj);
+}
+
+
+int vbuf_new_single(size_t capacity,
+		    size_t userdata_capacity,
+		    const struct vbuf_cbs *cbs,
+		    unsigned int flags,
+		    struct vbuf_buffer **ret_obj)
+{
+	unsigned int create_flags = VBUF_CREATE_SINGLE_ALLOC;
+
+	if (flags & VBUF_NEW_INLINE_PAYLOAD)
+		create_flags |= VBUF_CREATE_INLINE_PAYLOAD;
+	if (flags & VBUF_NEW_STATIC_CBS)
+		create_flags |= VBUF_CREATE_STATIC_CBS;
+
+	return vbuf_create(capacity,
+			   userdata_capacity,
+			   0,
+			   cbs,
+			   NULL,
+			   create_flags,
+			   ret_obj);
+}
+
+
+int vbuf_create(size_t capacity,
+		size_t userdata_capacity,
+		size_t meta_capacity,
+		const struct vbuf_cbs *cbs,
+		struct vbuf_pool *pool,
+		unsigned int flags,
+		struct vbuf_buffer **ret_obj)
+{
+	int res = 0, err, mutex_init = 0, inline_payload = 0;
+	size_t size, cbs_offset = 0, userdata_offset = 0, meta_offset = 0;
+	size_t payload_offset = 0;
+	void *mem = NULL;
 	struct vbuf_buffer *buf;
 
 	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
@@ -42,20 +167,70 @@ int vbuf_new(size_t capacity,
 	ULOG_ERRNO_RETURN_ERR_IF(cbs->free == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
 
-	buf = calloc(1, sizeof(*buf));
-	if (buf == NULL) {
-		res = -ENOMEM;
-		ULOG_ERRNO("calloc:buf", -res);
+	/* Memory block layout: buffer object, then optionally callback
+	 * functions table, user data, metadata arena and payload, each
+	 * starting on a cache line boundary */
+	size = vbuf_align_size(sizeof(*buf), VBUF_CACHE_LINE_SIZE);
+	if (!(flags & VBUF_CREATE_STATIC_CBS)) {
+		/* Private copy of the callback functions table */
+		cbs_offset = size;
+		size += vbuf_align_size(sizeof(*cbs), VBUF_CACHE_LINE_SIZE);
+	}
+	if ((flags & VBUF_CREATE_SINGLE_ALLOC) && (userdata_capacity > 0)) {
+		userdata_offset = size;
+		size += vbuf_align_size(userdata_capacity,
+					VBUF_CACHE_LINE_SIZE);
+	}
+	if (meta_capacity > 0) {
+		meta_offset = size;
+		meta_capacity = vbuf_align_size(meta_capacity, VBUF_META_ALIGN);
+		size += vbuf_align_size(meta_capacity, VBUF_CACHE_LINE_SIZE);
+	}
+	if ((flags & VBUF_CREATE_INLINE_PAYLOAD) && (capacity > 0)) {
+		inline_payload = 1;
+		payload_offset = size;
+		size += capacity;
+	}
+
+	res = posix_memalign(&mem, VBUF_CACHE_LINE_SIZE, size);
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign:buf", res);
 		*ret_obj = NULL;
 		return -res;
 	}
+	/* The inline payload is not initialized */
+	memset(mem, 0, inline_payload ? payload_offset : size);
+	buf = mem;
 
 	list_node_unref(&buf->node);
 	buf->capacity = capacity;
+	list_init(&buf->segments_before);
+	list_init(&buf->segments_after);
 	list_init(&buf->metas);
+	list_init(&buf->meta_retired);
 	buf->userdata_capacity = userdata_capacity;
-	buf->cbs = *cbs;
 	buf->pool = pool;
+	if (cbs_offset > 0) {
+		struct vbuf_cbs *cbs_copy =
+			(struct vbuf_cbs *)((uint8_t *)mem + cbs_offset);
+		*cbs_copy = *cbs;
+		buf->cbs = cbs_copy;
+	} else {
+		/* The table outlives the buffer, use it directly */
+		buf->cbs = cbs;
+	}
+	if (userdata_offset > 0) {
+		buf->userdata_ptr = (uint8_t *)mem + userdata_offset;
+		buf->userdata_inline = 1;
+	}
+	if (meta_offset > 0) {
+		buf->meta_arena = (uint8_t *)mem + meta_offset;
+		buf->meta_arena_capacity = meta_capacity;
+	}
+	if (inline_payload) {
+		buf->ptr = (uint8_t *)mem + payload_offset;
+		buf->inline_capacity = capacity;
+	}
 
 	res = pthread_mutex_init(&buf->mutex, NULL);
 	if (res != 0) {
@@ -66,14 +241,14 @@ int vbuf_new(size_t capacity,
 	mutex_init = 1;
 
 	/* Video frame */
-	res = (*buf->cbs.alloc)(buf, buf->cbs.alloc_userdata);
+	res = (*buf->cbs->alloc)(buf, buf->cbs->alloc_userdata);
 	if (res < 0) {
 		ULOG_ERRNO("buf->alloc", -res);
 		goto error;
 	}
 
 	/* User data */
-	if (buf->userdata_capacity > 0) {
+	if ((buf->userdata_capacity > 0) && (buf->userdata_ptr == NULL)) {
 		buf->userdata_ptr = calloc(1, buf->userdata_capacity);
 		if (buf->userdata_ptr == NULL) {
 			res = -ENOMEM;
@@ -83,6 +258,7 @@ int vbuf_new(size_t capacity,
 	}
 
 	vbuf_ref(buf);
+	vbuf_local_init(buf);
 
 	*ret_obj = buf;
 	return 0;
@@ -90,10 +266,11 @@ int vbuf_new(size_t capacity,
 error:
 	if (mutex_init)
 		pthread_mutex_destroy(&buf->mutex);
-	err = (*buf->cbs.free)(buf, buf->cbs.free_userdata);
+	err = (*buf->cbs->free)(buf, buf->cbs->free_userdata);
 	if (err < 0)
 		ULOG_ERRNO("buf->free", -err);
-	free(buf->userdata_ptr);
+	if (!buf->userdata_inline)
+		free(buf->userdata_ptr);
 	free(buf);
 	*ret_obj = NULL;
 	return res;
@@ -103,7 +280,6 @@ error:
 int vbuf_destroy(struct vbuf_buffer *buf)
 {
 	int res, ref;
-	struct vbuf_meta *meta = NULL, *tmp_meta = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
@@ -112,21 +288,26 @@ int vbuf_destroy(struct vbuf_buffer *buf)
 		ULOGW("ref count is not null! (%d)", ref);
 
 	/* Video frame */
-	res = (*buf->cbs.free)(buf, buf->cbs.free_userdata);
+	res = (*buf->cbs->free)(buf, buf->cbs->free_userdata);
 	if (res < 0)
 		ULOG_ERRNO("buf->free", -res);
 
+	/* Release all payload segments */
+	vbuf_segments_clear(buf);
+	free(buf->dirty_map);
+	buf->dirty_map = NULL;
+
 	/* Remove all metadata */
-	list_walk_entry_forward_safe(&buf->metas, meta, tmp_meta, node)
-	{
-		list_del(&meta->node);
-		vbuf_meta_destroy(meta);
-	}
+	vbuf_meta_clear(buf);
+	free(buf->meta_index);
+	buf->meta_index = NULL;
 
 	/* User data */
-	free(buf->userdata_ptr);
+	if (!buf->userdata_inline)
+		free(buf->userdata_ptr);
 	buf->userdata_ptr = NULL;
 
+	buf->cbs = NULL;
 	pthread_mutex_destroy(&buf->mutex);
 	free(buf);
 
@@ -135,11 +316,19 @@ int vbuf_destroy(struct vbuf_buffer *buf)
 
 
 int vbuf_ref(struct vbuf_buffer *buf)
+{
+	return vbuf_ref_n(buf, 1);
+}
+
+
+int vbuf_ref_n(struct vbuf_buffer *buf, unsigned int count)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
 #if defined(__GNUC__)
-	__atomic_add_fetch(&buf->ref_count, 1, __ATOMIC_SEQ_CST);
+	/* Taking a reference requires already holding one: no ordering is
+	 * needed */
+	__atomic_add_fetch(&buf->ref_count, count, __ATOMIC_RELAXED);
 #else
 #	error no atomic increment function found on this platform
 #endif
@@ -149,45 +338,161 @@ int vbuf_ref(struct vbuf_buffer *buf)
 
 
 int vbuf_unref(struct vbuf_buffer *buf)
+{
+	return vbuf_unref_n(buf, 1);
+}
+
+
+int vbuf_unref_n(struct vbuf_buffer *buf, unsigned int count)
 {
 	int ref = 0;
 	int res = 0;
+	unsigned int local;
 
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(!vbuf_is_ref(buf), ENOENT);
 
 #if defined(__GNUC__)
-	ref = __atomic_sub_fetch(&buf->ref_count, 1, __ATOMIC_SEQ_CST);
+	/* The owner thread releases its local references first; the last
+	 * one releases the reference held on behalf of all local references
+	 * (see vbuf_ref_local()) */
+	if ((__atomic_load_n(&buf->local_owner, __ATOMIC_RELAXED) ==
+	     (uintptr_t)&s_local_thread_id) &&
+	    (buf->local_ref_count > 0) && (count > 0)) {
+		local = (count < buf->local_ref_count) ? count
+						       : buf->local_ref_count;
+		__atomic_store_n(&buf->local_ref_count,
+				 buf->local_ref_count - local,
+				 __ATOMIC_RELAXED);
+		count -= local;
+		if (buf->local_ref_count == 0)
+			count++;
+	}
+#else
+#	error no atomic functions found on this platform
+#endif
+
+	if (count == 0)
+		return 0;
+
+#if defined(__GNUC__)
+	/* Release the accesses made through these references; the last
+	 * reference also acquires all of them before releasing the buffer */
+	ref = (int)__atomic_sub_fetch(&buf->ref_count, count, __ATOMIC_RELEASE);
+	if (ref < 0) {
+		/* The buffer was not referenced enough */
+		__atomic_add_fetch(&buf->ref_count, count, __ATOMIC_RELAXED);
+		ULOG_ERRNO("vbuf_unref", ENOENT);
+		return -ENOENT;
+	}
+	if (ref == 0)
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
 #else
 #	error no atomic decrement function found on this platform
 #endif
 
 	if (ref == 0) {
-		/* Call the callback function if implemented */
-		if (buf->cbs.unref) {
-			res = (*buf->cbs.unref)(buf, buf->cbs.unref_userdata);
-			if (res < 0) {
-				ULOG_ERRNO("buf->unref", -res);
-				goto out;
-			}
-		}
+		/* Release the buffer now or on the reclaimer thread */
+		if (buf->deferred_release)
+			res = vbuf_reclaim_push(buf);
+		else
+			res = vbuf_release(buf);
+	}
 
-		buf->write_locked = 0;
-		buf->size = 0;
+	return res;
+}
 
-		if (buf->pool) {
-			res = vbuf_pool_put(buf->pool, buf);
-			if (res < 0)
-				goto out;
-		} else {
-			res = vbuf_destroy(buf);
-			if (res < 0)
-				goto out;
+
+int vbuf_release(struct vbuf_buffer *buf)
+{
+	int res;
+
+	/* Call the callback function if implemented */
+	if (buf->cbs->unref) {
+		res = (*buf->cbs->unref)(buf, buf->cbs->unref_userdata);
+		if (res < 0) {
+			ULOG_ERRNO("buf->unref", -res);
+			return res;
 		}
 	}
 
-out:
-	return res;
+	buf->write_locked = 0;
+	buf->size = 0;
+	buf->local_owner = 0;
+	buf->local_ref_count = 0;
+
+	if (buf->pool)
+		return vbuf_pool_put(buf->pool, buf);
+	else
+		return vbuf_destroy(buf);
+}
+
+
+int vbuf_set_deferred_release(struct vbuf_buffer *buf, int enable)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	buf->deferred_release = enable ? 1 : 0;
+
+	return 0;
+}
+
+
+int vbuf_ref_local(struct vbuf_buffer *buf)
+{
+	uintptr_t self = (uintptr_t)&s_local_thread_id;
+	uintptr_t owner;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+#if defined(__GNUC__)
+	owner = __atomic_load_n(&buf->local_owner, __ATOMIC_RELAXED);
+	if ((owner == 0) &&
+	    __atomic_compare_exchange_n(&buf->local_owner,
+					&owner,
+					self,
+					0,
+					__ATOMIC_RELAXED,
+					__ATOMIC_RELAXED))
+		owner = self;
+	if (owner != self) {
+		/* Owned by another thread */
+		return vbuf_ref(buf);
+	}
+
+	/* The first local reference takes a reference on behalf of all
+	 * local references; the local count is only modified by the owner
+	 * thread (atomic stores are only used for vbuf_get_ref_count()) */
+	if (buf->local_ref_count == 0)
+		vbuf_ref(buf);
+	__atomic_store_n(&buf->local_ref_count,
+			 buf->local_ref_count + 1,
+			 __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+
+	return 0;
+}
+
+
+int vbuf_unref_local(struct vbuf_buffer *buf)
+{
+	/* The owner thread releases a local reference (the thread stays the
+	 * owner), other threads release a regular reference */
+	return vbuf_unref(buf);
+}
+
+
+void vbuf_local_init(struct vbuf_buffer *buf)
+{
+#if defined(__GNUC__)
+	__atomic_store_n(&buf->local_owner,
+			 (uintptr_t)&s_local_thread_id,
+			 __ATOMIC_RELAXED);
+	__atomic_store_n(&buf->local_ref_count, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
 }
 
 
@@ -208,10 +513,16 @@ int vbuf_get_ref_count(struct vbuf_buffer *buf)
 
 #if defined(__GNUC__)
 	int ref_count = __atomic_load_n(&buf->ref_count, __ATOMIC_ACQUIRE);
+	int local_ref_count =
+		__atomic_load_n(&buf->local_ref_count, __ATOMIC_RELAXED);
 #else
 #	error no atomic load function found on this platform
 #endif
 
+	/* The local references hold a single reference */
+	if (local_ref_count > 0)
+		ref_count += local_ref_count - 1;
+
 	return ref_count;
 }
 
@@ -219,12 +530,7 @@ int vbuf_get_ref_count(struct vbuf_buffer *buf)
 int vbuf_write_lock(struct vbuf_buffer *buf)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-#if defined(__GNUC__)
-	int ref_count = __atomic_load_n(&buf->ref_count, __ATOMIC_ACQUIRE);
-#else
-#	error no atomic load function found on this platform
-#endif
-	ULOG_ERRNO_RETURN_ERR_IF(ref_count != 1, EBUSY);
+	ULOG_ERRNO_RETURN_ERR_IF(vbuf_get_ref_count(buf) != 1, EBUSY);
 
 	buf->write_locked = 1;
 	return 0;
@@ -234,12 +540,7 @@ int vbuf_write_lock(struct vbuf_buffer *buf)
 int vbuf_write_unlock(struct vbuf_buffer *buf)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-#if defined(__GNUC__)
-	int ref_count = __atomic_load_n(&buf->ref_count, __ATOMIC_ACQUIRE);
-#else
-#	error no atomic load function found on this platform
-#endif
-	ULOG_ERRNO_RETURN_ERR_IF(ref_count != 1, EBUSY);
+	ULOG_ERRNO_RETURN_ERR_IF(vbuf_get_ref_count(buf) != 1, EBUSY);
 
 	buf->write_locked = 0;
 	return 0;
@@ -262,11 +563,44 @@ struct vbuf_pool *vbuf_get_pool(struct vbuf_buffer *buf)
 }
 
 
+/* Make a private copy of a shared payload (clones and slices) */
+static int vbuf_unshare(struct vbuf_buffer *buf)
+{
+	int res;
+	void *ptr = NULL;
+
+	if (buf->parent == NULL)
+		return 0;
+
+	/* Keep the payload alignment for the planes (see vbuf_set_planes()) */
+	res = posix_memalign(&ptr,
+			     VBUF_CACHE_LINE_SIZE,
+			     (buf->capacity > 0) ? buf->capacity : 1);
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign:unshare", res);
+		return -res;
+	}
+	memcpy(ptr, buf->ptr, buf->capacity);
+	buf->ptr = ptr;
+	vbuf_unref(buf->parent);
+	buf->parent = NULL;
+
+	return 0;
+}
+
+
 uint8_t *vbuf_get_data(struct vbuf_buffer *buf)
 {
+	int res;
+
 	ULOG_ERRNO_RETURN_VAL_IF(buf == NULL, EINVAL, NULL);
 	ULOG_ERRNO_RETURN_VAL_IF(buf->write_locked, EPERM, NULL);
 
+	if (buf->parent != NULL) {
+		res = vbuf_unshare(buf);
+		ULOG_ERRNO_RETURN_VAL_IF(res < 0, -res, NULL);
+	}
+
 	return buf->ptr;
 }
 
@@ -287,25 +621,104 @@ ssize_t vbuf_get_capacity(struct vbuf_buffer *buf)
 }
 
 
+/* Mark the dirty tiles in [first, end) */
+static void vbuf_dirty_set(uint64_t *map, size_t first, size_t end)
+{
+	size_t w, last_w;
+	uint64_t first_mask, last_mask;
+
+	if (first >= end)
+		return;
+	w = first / 64;
+	last_w = (end - 1) / 64;
+	first_mask = UINT64_MAX << (first % 64);
+	last_mask = UINT64_MAX >> (63 - (end - 1) % 64);
+	if (w == last_w) {
+		map[w] |= first_mask & last_mask;
+		return;
+	}
+	map[w++] |= first_mask;
+	for (; w < last_w; w++)
+		map[w] = UINT64_MAX;
+	map[last_w] |= last_mask;
+}
+
+
+/* Record a modification of the buffer payload in [offset, offset + len)
+ * (within the capacity): the tiles are marked dirty and the buffer no
+ * longer holds the result of a vbuf_copy_dirty() */
+static void vbuf_dirty_write(struct vbuf_buffer *buf, size_t offset, size_t len)
+{
+	buf->dirty_synced_gen = 0;
+	if ((buf->dirty_tile_size == 0) || (len == 0))
+		return;
+
+	vbuf_dirty_set(buf->dirty_map,
+		       offset / buf->dirty_tile_size,
+		       (offset + len - 1) / buf->dirty_tile_size + 1);
+}
+
+
+/* Resize the dirty tiles bitmap to the buffer capacity; the new tiles are
+ * dirty */
+static int vbuf_dirty_resize(struct vbuf_buffer *buf)
+{
+	size_t count, words, old_words;
+	uint64_t *map;
+
+	count = (buf->capacity + buf->dirty_tile_size - 1) /
+		buf->dirty_tile_size;
+	if (count <= buf->dirty_tile_count)
+		return 0;
+
+	words = (count + 63) / 64;
+	old_words = (buf->dirty_tile_count + 63) / 64;
+	if (words > old_words) {
+		map = realloc(buf->dirty_map, words * sizeof(*map));
+		if (map == NULL) {
+			ULOG_ERRNO("realloc:dirty_map", ENOMEM);
+			return -ENOMEM;
+		}
+		memset(map + old_words, 0, (words - old_words) * sizeof(*map));
+		buf->dirty_map = map;
+	}
+	vbuf_dirty_set(buf->dirty_map, buf->dirty_tile_count, count);
+	buf->dirty_tile_count = count;
+
+	return 0;
+}
+
+
 ssize_t vbuf_set_capacity(struct vbuf_buffer *buf, size_t capacity)
 {
 	size_t old_capacity;
 	int res;
 
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(buf->cbs.realloc == NULL, ENOSYS);
+	ULOG_ERRNO_RETURN_ERR_IF(buf->cbs->realloc == NULL, ENOSYS);
 	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
 
 	old_capacity = buf->capacity;
 
+	if ((capacity > buf->capacity) && (buf->parent != NULL)) {
+		res = vbuf_unshare(buf);
+		if (res < 0)
+			return res;
+	}
+
 	if (capacity > buf->capacity) {
 		buf->capacity = capacity;
-		res = (*buf->cbs.realloc)(buf, buf->cbs.realloc_userdata);
+		res = (*buf->cbs->realloc)(buf, buf->cbs->realloc_userdata);
 		if (res < 0) {
 			buf->capacity = old_capacity;
 			ULOG_ERRNO("buf->realloc", -res);
 			return res;
 		}
+		if (buf->dirty_tile_size > 0) {
+			res = vbuf_dirty_resize(buf);
+			if (res < 0)
+				return res;
+		}
 	}
 
 	return (ssize_t)buf->capacity;
@@ -326,32 +739,148 @@ int vbuf_set_size(struct vbuf_buffer *buf, size_t size)
 	ULOG_ERRNO_RETURN_ERR_IF(size > buf->capacity, ENOBUFS);
 	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
 
+	/* The data beyond the previous size was not tracked */
+	if (size > buf->size)
+		vbuf_dirty_write(buf, buf->size, size - buf->size);
 	buf->size = size;
 
 	return 0;
 }
 
 
-int vbuf_copy(struct vbuf_buffer *src_buf, struct vbuf_buffer *dst_buf)
+static inline int vbuf_is_pow2(size_t val)
+{
+	return (val & (val - 1)) == 0;
+}
+
+
+ssize_t vbuf_planes_layout(unsigned int count,
+			   const size_t *widths,
+			   const size_t *heights,
+			   size_t align,
+			   struct vbuf_plane *planes)
+{
+	unsigned int i;
+	size_t size = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count > VBUF_MAX_PLANES, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(widths == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(heights == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!vbuf_is_pow2(align), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(planes == NULL, EINVAL);
+
+	if (align == 0)
+		align = 1;
+	for (i = 0; i < count; i++) {
+		planes[i].offset = size;
+		planes[i].stride = vbuf_align_size(widths[i], align);
+		planes[i].height = heights[i];
+		planes[i].align = align;
+		size += vbuf_align_size(planes[i].stride * heights[i], align);
+	}
+
+	return (ssize_t)size;
+}
+
+
+int vbuf_set_planes(struct vbuf_buffer *buf,
+		    const struct vbuf_plane *planes,
+		    unsigned int count)
+{
+	unsigned int i;
+	size_t align;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((planes == NULL) && (count > 0), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count > VBUF_MAX_PLANES, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
+
+	for (i = 0; i < count; i++) {
+		align = (planes[i].align > 0) ? planes[i].align : 1;
+		ULOG_ERRNO_RETURN_ERR_IF(!vbuf_is_pow2(align), EINVAL);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			(planes[i].height > 0) && (planes[i].stride >
+						   SIZE_MAX / planes[i].height),
+			EINVAL);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			(planes[i].offset > buf->capacity) ||
+				(planes[i].stride * planes[i].height >
+				 buf->capacity - planes[i].offset),
+			ENOBUFS);
+		ULOG_ERRNO_RETURN_ERR_IF(
+			(((uintptr_t)buf->ptr + planes[i].offset) & (align - 1)) ||
+				(planes[i].stride & (align - 1)),
+			EINVAL);
+	}
+
+	memcpy(buf->planes, planes, count * sizeof(*planes));
+	buf->plane_count = count;
+
+	return 0;
+}
+
+
+int vbuf_get_plane_count(struct vbuf_buffer *buf)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	return (int)buf->plane_count;
+}
+
+
+int vbuf_get_plane(struct vbuf_buffer *buf,
+		   unsigned int index,
+		   struct vbuf_plane *plane)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(index >= buf->plane_count, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(plane == NULL, EINVAL);
+
+	*plane = buf->planes[index];
+
+	return 0;
+}
+
+
+/* Prepare a copy: set up the destination buffer size, planes, user data
+ * and metadata; the payload is then copied using vbuf_copy_gather() */
+static int vbuf_copy_prepare(struct vbuf_buffer *src_buf,
+			     struct vbuf_buffer *dst_buf)
 {
 	int res;
+	unsigned int i;
+	size_t size, offset = 0;
+	struct vbuf_segment *seg = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == src_buf, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(dst_buf->write_locked, EPERM);
 
-	if (dst_buf->capacity < src_buf->size) {
-		res = vbuf_set_capacity(dst_buf, src_buf->size);
+	/* The source segments are gathered in the destination payload */
+	size = src_buf->size + src_buf->segments_size;
+	if (dst_buf->capacity < size) {
+		res = vbuf_set_capacity(dst_buf, size);
 		if (res < 0)
 			return res;
 	}
-	if (src_buf->size > 0) {
-		memcpy(dst_buf->ptr, src_buf->ptr, src_buf->size);
-		res = vbuf_set_size(dst_buf, src_buf->size);
-		if (res < 0)
-			return res;
+	vbuf_segments_clear(dst_buf);
+	if ((size > 0) && (vbuf_get_data(dst_buf) == NULL))
+		return -EPERM;
+	res = vbuf_set_size(dst_buf, size);
+	if (res < 0)
+		return res;
+
+	/* The planes are relative to the source own payload, which comes
+	 * after the prepended segments */
+	list_walk_entry_forward(&src_buf->segments_before, seg, node)
+		offset += seg->len;
+	for (i = 0; i < src_buf->plane_count; i++) {
+		dst_buf->planes[i] = src_buf->planes[i];
+		dst_buf->planes[i].offset += offset;
 	}
+	dst_buf->plane_count = src_buf->plane_count;
 
 	res = vbuf_userdata_copy(src_buf, dst_buf);
 	if (res < 0)
@@ -365,62 +894,1194 @@ int vbuf_copy(struct vbuf_buffer *src_buf, struct vbuf_buffer *dst_buf)
 }
 
 
-struct vbuf_meta *vbuf_meta_new(void *key, unsigned int level, size_t len)
+/* Call the copy function for each payload segment of the source buffer
+ * (including its own payload) and its destination in the destination
+ * buffer payload */
+static void vbuf_copy_gather(struct vbuf_buffer *src_buf,
+			     struct vbuf_buffer *dst_buf,
+			     void (*copy)(void *ctx,
+					  uint8_t *dst,
+					  const uint8_t *src,
+					  size_t len),
+			     void *ctx)
 {
-	struct vbuf_meta *meta;
+	uint8_t *ptr = dst_buf->ptr;
+	struct vbuf_segment *seg = NULL;
 
-	ULOG_ERRNO_RETURN_VAL_IF(key == NULL, EINVAL, NULL);
-	ULOG_ERRNO_RETURN_VAL_IF(len == 0, EINVAL, NULL);
-
-	meta = calloc(1, sizeof(*meta));
-	if (meta == NULL) {
-		ULOG_ERRNO("calloc:meta", ENOMEM);
-		return NULL;
+	list_walk_entry_forward(&src_buf->segments_before, seg, node)
+	{
+		(*copy)(ctx, ptr, seg->ptr, seg->len);
+		ptr += seg->len;
 	}
-	list_node_unref(&meta->node);
-	meta->key = key;
-	meta->level = level;
-	meta->len = len;
-	meta->data = calloc(1, len);
-	if (meta->data == NULL) {
-		free(meta);
-		ULOG_ERRNO("calloc:data", ENOMEM);
-		return NULL;
+	if (src_buf->size > 0) {
+		(*copy)(ctx, ptr, src_buf->ptr, src_buf->size);
+		ptr += src_buf->size;
+	}
+	list_walk_entry_forward(&src_buf->segments_after, seg, node)
+	{
+		(*copy)(ctx, ptr, seg->ptr, seg->len);
+		ptr += seg->len;
 	}
+}
 
-	return meta;
+
+static void
+vbuf_copy_sync_cb(void *ctx, uint8_t *dst, const uint8_t *src, size_t len)
+{
+	vbuf_memcpy(dst, src, len);
 }
 
 
-int vbuf_meta_destroy(struct vbuf_meta *meta)
+int vbuf_copy(struct vbuf_buffer *src_buf, struct vbuf_buffer *dst_buf)
 {
-	ULOG_ERRNO_RETURN_ERR_IF(meta == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(!list_node_is_unref(&meta->node), EBUSY);
+	int res;
+
+	res = vbuf_copy_prepare(src_buf, dst_buf);
+	if (res < 0)
+		return res;
 
-	free(meta->data);
-	free(meta);
+	vbuf_copy_gather(src_buf, dst_buf, vbuf_copy_sync_cb, NULL);
+	vbuf_dirty_write(dst_buf, 0, dst_buf->size);
 
 	return 0;
 }
 
 
-struct vbuf_meta *vbuf_meta_find(struct vbuf_buffer *buf, void *key)
+/* Asynchronous copy task: a chunk of the payload copied by a worker */
+struct vbuf_copy_task {
+	struct vbuf_work work;
+	struct vbuf_copy_job *job;
+	uint8_t *dst;
+	const uint8_t *src;
+	size_t len;
+};
+
+
+/* Asynchronous copy job */
+struct vbuf_copy_job {
+	struct vbuf_buffer *src_buf;
+	struct vbuf_buffer *dst_buf;
+	vbuf_copy_cb_t cb;
+	void *userdata;
+	/* Chunk size */
+	size_t chunk;
+	/* Tasks count and not yet completed tasks count */
+	unsigned int count;
+	unsigned int pending;
+	struct vbuf_copy_task tasks[];
+};
+
+
+static void vbuf_copy_task_run(struct vbuf_work *work)
 {
-	int found = 0;
-	struct vbuf_meta *meta = NULL;
+	unsigned int pending;
+	struct vbuf_copy_task *task =
+		list_entry(work, struct vbuf_copy_task, work);
+	struct vbuf_copy_job *job = task->job;
 
-	ULOG_ERRNO_RETURN_VAL_IF(buf == NULL, EINVAL, NULL);
-	ULOG_ERRNO_RETURN_VAL_IF(key == NULL, EINVAL, NULL);
+	if (task->len > 0)
+		vbuf_memcpy(task->dst, task->src, task->len);
 
-	list_walk_entry_forward(&buf->metas, meta, node)
-	{
-		if (meta->key == key) {
-			found = 1;
-			break;
+#if defined(__GNUC__)
+	pending = __atomic_sub_fetch(&job->pending, 1, __ATOMIC_ACQ_REL);
+#else
+#	error no atomic decrement function found on this platform
+#endif
+	if (pending > 0)
+		return;
+
+	/* Last task: the copy is complete */
+	job->dst_buf->write_locked = 0;
+	if (job->cb != NULL)
+		(*job->cb)(job->src_buf, job->dst_buf, 0, job->userdata);
+	vbuf_unref(job->src_buf);
+	vbuf_unref(job->dst_buf);
+	free(job);
+}
+
+
+/* Count the chunk tasks of a segment (counting pass, job->pending is 0)
+ * or set them up */
+static void
+vbuf_copy_split_cb(void *ctx, uint8_t *dst, const uint8_t *src, size_t len)
+{
+	struct vbuf_copy_job *job = ctx;
+	struct vbuf_copy_task *task;
+	size_t chunk;
+
+	while (len > 0) {
+		chunk = (len < job->chunk) ? len : job->chunk;
+		if (job->pending > 0) {
+			task = &job->tasks[job->count];
+			task->work.fn = vbuf_copy_task_run;
+			task->job = job;
+			task->dst = dst;
+			task->src = src;
+			task->len = chunk;
+		}
+		job->count++;
+		dst += chunk;
+		src += chunk;
+		len -= chunk;
+	}
+}
+
+
+int vbuf_copy_async(struct vbuf_buffer *src_buf,
+		    struct vbuf_buffer *dst_buf,
+		    vbuf_copy_cb_t cb,
+		    void *userdata)
+{
+	int res;
+	unsigned int i;
+	size_t size;
+	struct vbuf_copy_job *job, tmp_job;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!src_buf->write_locked, EPERM);
+
+	res = vbuf_copy_prepare(src_buf, dst_buf);
+	if (res < 0)
+		return res;
+	vbuf_dirty_write(dst_buf, 0, dst_buf->size);
+
+	/* Split the payload in chunks, one per worker at least */
+	size = dst_buf->size;
+	memset(&tmp_job, 0, sizeof(tmp_job));
+	tmp_job.chunk = (size + vbuf_worker_get_count() - 1) /
+			vbuf_worker_get_count();
+	if (tmp_job.chunk < VBUF_COPY_ASYNC_MIN_CHUNK)
+		tmp_job.chunk = VBUF_COPY_ASYNC_MIN_CHUNK;
+	vbuf_copy_gather(src_buf, dst_buf, vbuf_copy_split_cb, &tmp_job);
+
+	/* At least one task is needed to call the completion callback
+	 * from a worker */
+	if (tmp_job.count == 0)
+		tmp_job.count = 1;
+	job = calloc(1, sizeof(*job) + tmp_job.count * sizeof(*job->tasks));
+	if (job == NULL) {
+		ULOG_ERRNO("calloc:job", ENOMEM);
+		return -ENOMEM;
+	}
+	job->src_buf = src_buf;
+	job->dst_buf = dst_buf;
+	job->cb = cb;
+	job->userdata = userdata;
+	job->chunk = tmp_job.chunk;
+	job->pending = tmp_job.count;
+	job->tasks[0].work.fn = vbuf_copy_task_run;
+	job->tasks[0].job = job;
+	vbuf_copy_gather(src_buf, dst_buf, vbuf_copy_split_cb, job);
+
+	/* The destination buffer stays write-locked and both buffers stay
+	 * referenced until the copy is complete */
+	vbuf_ref(src_buf);
+	vbuf_ref(dst_buf);
+	dst_buf->write_locked = 1;
+	for (i = 0; i < tmp_job.count; i++)
+		vbuf_worker_submit(&job->tasks[i].work);
+
+	return 0;
+}
+
+
+/* Compute the end offset of a 2D region; returns -EINVAL on overflow */
+static int vbuf_rect_end(size_t offset,
+			 size_t stride,
+			 size_t width,
+			 size_t height,
+			 size_t *end)
+{
+	size_t last;
+
+	if ((height > 0) && (stride > (SIZE_MAX - width) / height))
+		return -EINVAL;
+	last = (height > 0) ? (height - 1) * stride + width : 0;
+	if (offset > SIZE_MAX - last)
+		return -EINVAL;
+	*end = offset + last;
+
+	return 0;
+}
+
+
+int vbuf_copy_rect(struct vbuf_buffer *src_buf,
+		   size_t src_offset,
+		   size_t src_stride,
+		   struct vbuf_buffer *dst_buf,
+		   size_t dst_offset,
+		   size_t dst_stride,
+		   size_t width,
+		   size_t height)
+{
+	int res;
+	size_t src_end, dst_end;
+	uint8_t *ptr;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == src_buf, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(dst_buf->write_locked, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF((height > 1) && (width > src_stride), EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF((height > 1) && (width > dst_stride), EINVAL);
+
+	res = vbuf_rect_end(src_offset, src_stride, width, height, &src_end);
+	ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+	ULOG_ERRNO_RETURN_ERR_IF(src_end > src_buf->size, EINVAL);
+	res = vbuf_rect_end(dst_offset, dst_stride, width, height, &dst_end);
+	ULOG_ERRNO_RETURN_ERR_IF(res < 0, -res);
+	ULOG_ERRNO_RETURN_ERR_IF(dst_end > dst_buf->capacity, ENOBUFS);
+
+	if ((width == 0) || (height == 0))
+		return 0;
+
+	ptr = vbuf_get_data(dst_buf);
+	if (ptr == NULL)
+		return -EPERM;
+	vbuf_dirty_write(dst_buf, dst_offset, dst_end - dst_offset);
+	vbuf_memcpy_2d(ptr + dst_offset,
+		       dst_stride,
+		       src_buf->ptr + src_offset,
+		       src_stride,
+		       width,
+		       height);
+	if (dst_buf->size < dst_end)
+		dst_buf->size = dst_end;
+
+	return 0;
+}
+
+
+int vbuf_set_dirty_tracking(struct vbuf_buffer *buf, size_t tile_size)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!vbuf_is_pow2(tile_size), EINVAL);
+
+	free(buf->dirty_map);
+	buf->dirty_map = NULL;
+	buf->dirty_tile_count = 0;
+	buf->dirty_tile_size = tile_size;
+	if (tile_size == 0)
+		return 0;
+
+	/* All tiles are initially dirty */
+	return vbuf_dirty_resize(buf);
+}
+
+
+int vbuf_mark_dirty(struct vbuf_buffer *buf, size_t offset, size_t len)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(offset > buf->capacity, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len > buf->capacity - offset, EINVAL);
+
+	vbuf_dirty_write(buf, offset, len);
+
+	return 0;
+}
+
+
+int vbuf_mark_plane_dirty(struct vbuf_buffer *buf,
+			  unsigned int index,
+			  size_t x,
+			  size_t y,
+			  size_t width,
+			  size_t height)
+{
+	int res;
+	size_t i;
+	struct vbuf_plane *plane;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(index >= buf->plane_count, EINVAL);
+
+	plane = &buf->planes[index];
+	ULOG_ERRNO_RETURN_ERR_IF(x > plane->stride, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(width > plane->stride - x, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(y > plane->height, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(height > plane->height - y, EINVAL);
+
+	for (i = y; i < y + height; i++) {
+		res = vbuf_mark_dirty(
+			buf, plane->offset + i * plane->stride + x, width);
+		if (res < 0)
+			return res;
+	}
+
+	return 0;
+}
+
+
+/* Clear the dirty tiles that are entirely within the buffer size (the
+ * last partial tile may have been modified beyond the size) */
+static void vbuf_dirty_clear(struct vbuf_buffer *buf)
+{
+	size_t end = buf->size / buf->dirty_tile_size;
+
+	memset(buf->dirty_map, 0, (end / 64) * sizeof(*buf->dirty_map));
+	if (end % 64)
+		buf->dirty_map[end / 64] &= UINT64_MAX << (end % 64);
+}
+
+
+/* Record a vbuf_copy_dirty(): the source buffer dirty tiles are cleared,
+ * and the destination buffer is the one holding the copy */
+static void vbuf_dirty_sync(struct vbuf_buffer *src_buf,
+			    struct vbuf_buffer *dst_buf)
+{
+	uint64_t gen;
+
+#if defined(__GNUC__)
+	gen = __atomic_add_fetch(&s_dirty_gen, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic increment function found on this platform
+#endif
+
+	vbuf_dirty_clear(src_buf);
+	src_buf->dirty_gen = gen;
+	dst_buf->dirty_synced_gen = gen;
+}
+
+
+int vbuf_copy_dirty(struct vbuf_buffer *src_buf, struct vbuf_buffer *dst_buf)
+{
+	int res;
+	size_t t, count, first, start, end;
+	uint64_t word;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
+
+	/* Full copy when the source has no dirty tracking, when its
+	 * segments have to be gathered, or when the destination does not
+	 * hold the result of the previous vbuf_copy_dirty() of the source
+	 * (the dirty tiles are only tracked since then) */
+	if ((src_buf->dirty_tile_size == 0) || (src_buf->segment_count > 0) ||
+	    (dst_buf == NULL) || (src_buf->dirty_gen == 0) ||
+	    (dst_buf->dirty_synced_gen != src_buf->dirty_gen)) {
+		res = vbuf_copy(src_buf, dst_buf);
+		if ((res == 0) && (src_buf->dirty_tile_size > 0))
+			vbuf_dirty_sync(src_buf, dst_buf);
+		return res;
+	}
+
+	/* The destination still holds the metadata and user data of the
+	 * previous copy */
+	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == src_buf, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(dst_buf->write_locked, EPERM);
+	vbuf_meta_remove_all(dst_buf);
+	res = vbuf_set_userdata_size(dst_buf, 0);
+	if (res < 0)
+		return res;
+
+	res = vbuf_copy_prepare(src_buf, dst_buf);
+	if (res < 0)
+		return res;
+
+	/* Copy the runs of consecutive dirty tiles, skipping clean words */
+	count = (src_buf->size + src_buf->dirty_tile_size - 1) /
+		src_buf->dirty_tile_size;
+	t = 0;
+	while (t < count) {
+		word = src_buf->dirty_map[t / 64] >> (t % 64);
+		if (word == 0) {
+			t = (t / 64 + 1) * 64;
+			continue;
+		}
+		t += __builtin_ctzll(word);
+		if (t >= count)
+			break;
+		first = t;
+		while ((t < count) &&
+		       (src_buf->dirty_map[t / 64] & (UINT64_C(1) << (t % 64))))
+			t++;
+		start = first * src_buf->dirty_tile_size;
+		end = t * src_buf->dirty_tile_size;
+		if (end > src_buf->size)
+			end = src_buf->size;
+		vbuf_memcpy(dst_buf->ptr + start, src_buf->ptr + start,
+			    end - start);
+		vbuf_dirty_write(dst_buf, start, end - start);
+	}
+
+	vbuf_dirty_sync(src_buf, dst_buf);
+
+	return 0;
+}
+
+
+/* Add a segment referencing a range of memory owned by a buffer (the
+ * owner buffer must be write-locked) after the prev node of one of the
+ * buffer segments lists */
+static int vbuf_segment_insert(struct vbuf_buffer *buf,
+			       struct list_node *prev,
+			       struct vbuf_buffer *owner,
+			       const uint8_t *ptr,
+			       size_t len)
+{
+	struct vbuf_segment *seg;
+
+	seg = calloc(1, sizeof(*seg));
+	if (seg == NULL) {
+		ULOG_ERRNO("calloc:segment", ENOMEM);
+		return -ENOMEM;
+	}
+	vbuf_ref(owner);
+	seg->owner = owner;
+	seg->ptr = ptr;
+	seg->len = len;
+	list_add_after(prev, &seg->node);
+	buf->segment_count++;
+	buf->segments_size += len;
+
+	return 0;
+}
+
+
+/* Create a buffer that shares a range of the payload memory of a
+ * write-locked buffer (clones and slices) */
+static int vbuf_view_new(struct vbuf_buffer *src_buf,
+			 size_t offset,
+			 size_t len,
+			 size_t userdata_capacity,
+			 struct vbuf_buffer **ret_obj)
+{
+	int res;
+	struct vbuf_buffer *buf = NULL, *parent;
+
+	res = vbuf_create(0,
+			  userdata_capacity,
+			  0,
+			  &s_clone_cbs,
+			  NULL,
+			  VBUF_CREATE_SINGLE_ALLOC | VBUF_CREATE_STATIC_CBS,
+			  &buf);
+	if (res < 0)
+		return res;
+
+	/* Reference the buffer that owns the payload memory (the source
+	 * buffer itself unless it is a view that still shares it) */
+	parent = (src_buf->parent != NULL) ? src_buf->parent : src_buf;
+	vbuf_ref(parent);
+	buf->parent = parent;
+	buf->ptr = src_buf->ptr + offset;
+	buf->capacity = len;
+	buf->size = len;
+
+	*ret_obj = buf;
+	return 0;
+}
+
+
+int vbuf_clone(struct vbuf_buffer *src_buf, struct vbuf_buffer **ret_obj)
+{
+	int res;
+	struct vbuf_buffer *buf = NULL;
+	struct vbuf_segment *seg = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!src_buf->write_locked, EPERM);
+
+	res = vbuf_view_new(
+		src_buf, 0, src_buf->capacity, src_buf->userdata_capacity, &buf);
+	if (res < 0)
+		goto error;
+	buf->size = src_buf->size;
+	buf->plane_count = src_buf->plane_count;
+	memcpy(buf->planes,
+	       src_buf->planes,
+	       src_buf->plane_count * sizeof(*src_buf->planes));
+
+	/* Share the source payload segments */
+	list_walk_entry_forward(&src_buf->segments_before, seg, node)
+	{
+		res = vbuf_segment_insert(buf,
+					  list_last(&buf->segments_before),
+					  seg->owner,
+					  seg->ptr,
+					  seg->len);
+		if (res < 0)
+			goto error;
+	}
+	list_walk_entry_forward(&src_buf->segments_after, seg, node)
+	{
+		res = vbuf_segment_insert(buf,
+					  list_last(&buf->segments_after),
+					  seg->owner,
+					  seg->ptr,
+					  seg->len);
+		if (res < 0)
+			goto error;
+	}
+
+	res = vbuf_userdata_copy(src_buf, buf);
+	if (res < 0)
+		goto error;
+
+	res = vbuf_metadata_copy(src_buf, buf, 0);
+	if (res < 0)
+		goto error;
+
+	*ret_obj = buf;
+	return 0;
+
+error:
+	if (buf != NULL)
+		vbuf_unref(buf);
+	*ret_obj = NULL;
+	return res;
+}
+
+
+int vbuf_slice(struct vbuf_buffer *src_buf,
+	       size_t offset,
+	       size_t len,
+	       size_t userdata_capacity,
+	       struct vbuf_buffer **ret_obj)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!src_buf->write_locked, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(offset > src_buf->size, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len > src_buf->size - offset, EINVAL);
+
+	return vbuf_view_new(src_buf, offset, len, userdata_capacity, ret_obj);
+}
+
+
+static int vbuf_segment_add(struct vbuf_buffer *buf,
+			    struct vbuf_buffer *seg_buf,
+			    size_t offset,
+			    size_t len,
+			    int before)
+{
+	struct vbuf_buffer *owner;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(seg_buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(seg_buf == buf, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(!seg_buf->write_locked, EPERM);
+	ULOG_ERRNO_RETURN_ERR_IF(offset > seg_buf->size, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(len > seg_buf->size - offset, EINVAL);
+
+	/* Reference the buffer that owns the payload memory, as for
+	 * clones and slices */
+	owner = (seg_buf->parent != NULL) ? seg_buf->parent : seg_buf;
+
+	/* Prepended segments are inserted at the head of the list before
+	 * the payload, appended segments at the tail of the list after
+	 * the payload */
+	return vbuf_segment_insert(buf,
+				   before ? &buf->segments_before
+					  : list_last(&buf->segments_after),
+				   owner,
+				   seg_buf->ptr + offset,
+				   len);
+}
+
+
+int vbuf_append_segment(struct vbuf_buffer *buf,
+			struct vbuf_buffer *seg_buf,
+			size_t offset,
+			size_t len)
+{
+	return vbuf_segment_add(buf, seg_buf, offset, len, 0);
+}
+
+
+int vbuf_prepend_segment(struct vbuf_buffer *buf,
+			 struct vbuf_buffer *seg_buf,
+			 size_t offset,
+			 size_t len)
+{
+	return vbuf_segment_add(buf, seg_buf, offset, len, 1);
+}
+
+
+void vbuf_segments_clear(struct vbuf_buffer *buf)
+{
+	struct vbuf_segment *seg = NULL, *tmp_seg = NULL;
+
+	list_walk_entry_forward_safe(&buf->segments_before, seg, tmp_seg, node)
+	{
+		list_del(&seg->node);
+		vbuf_unref(seg->owner);
+		free(seg);
+	}
+	list_walk_entry_forward_safe(&buf->segments_after, seg, tmp_seg, node)
+	{
+		list_del(&seg->node);
+		vbuf_unref(seg->owner);
+		free(seg);
+	}
+	buf->segment_count = 0;
+	buf->segments_size = 0;
+}
+
+
+int vbuf_get_segment_count(struct vbuf_buffer *buf)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	return (int)buf->segment_count + ((buf->size > 0) ? 1 : 0);
+}
+
+
+ssize_t vbuf_get_total_size(struct vbuf_buffer *buf)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	return (ssize_t)(buf->size + buf->segments_size);
+}
+
+
+int vbuf_get_iovec(struct vbuf_buffer *buf,
+		   struct iovec *iov,
+		   unsigned int iovcnt)
+{
+	unsigned int count = 0;
+	struct vbuf_segment *seg = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(iov == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		iovcnt < (unsigned int)vbuf_get_segment_count(buf), ENOBUFS);
+
+	/* The iovec structure is not const-qualified; the memory must only
+	 * be read (the buffer and segments are write-locked or shared) */
+	list_walk_entry_forward(&buf->segments_before, seg, node)
+	{
+		iov[count].iov_base = (void *)seg->ptr;
+		iov[count].iov_len = seg->len;
+		count++;
+	}
+	if (buf->size > 0) {
+		iov[count].iov_base = buf->ptr;
+		iov[count].iov_len = buf->size;
+		count++;
+	}
+	list_walk_entry_forward(&buf->segments_after, seg, node)
+	{
+		iov[count].iov_base = (void *)seg->ptr;
+		iov[count].iov_len = seg->len;
+		count++;
+	}
+
+	return (int)count;
+}
+
+
+/* Create a metadata data block initialized with a copy of data */
+static struct vbuf_meta_blob *vbuf_meta_blob_new(const uint8_t *data,
+						 size_t len)
+{
+	struct vbuf_meta_blob *blob;
+	size_t header_size;
+
+	header_size = vbuf_align_size(sizeof(*blob), VBUF_META_ALIGN);
+	blob = malloc(header_size + len);
+	if (blob == NULL) {
+		ULOG_ERRNO("malloc:blob", ENOMEM);
+		return NULL;
+	}
+	blob->ref_count = 1;
+	blob->user_count = 1;
+	blob->data = (uint8_t *)blob + header_size;
+	memcpy(blob->data, data, len);
+
+	return blob;
+}
+
+
+static void vbuf_meta_blob_ref(struct vbuf_meta_blob *blob)
+{
+	__atomic_add_fetch(&blob->ref_count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&blob->user_count, 1, __ATOMIC_RELAXED);
+}
+
+
+/* A metadata entry no longer uses the data (it is kept referenced until
+ * the entry is released) */
+static void vbuf_meta_blob_unuse(struct vbuf_meta_blob *blob)
+{
+	__atomic_sub_fetch(&blob->user_count, 1, __ATOMIC_RELEASE);
+}
+
+
+static void vbuf_meta_blob_unref(struct vbuf_meta_blob *blob)
+{
+	if (__atomic_sub_fetch(&blob->ref_count, 1, __ATOMIC_ACQ_REL) == 0)
+		free(blob);
+}
+
+
+static int vbuf_meta_blob_is_shared(struct vbuf_meta_blob *blob)
+{
+	return __atomic_load_n(&blob->user_count, __ATOMIC_ACQUIRE) > 1;
+}
+
+
+struct vbuf_meta *vbuf_meta_new(struct vbuf_buffer *buf,
+			       void *key,
+			       unsigned int level,
+			       size_t len,
+			       struct vbuf_meta_blob *blob)
+{
+	struct vbuf_meta *meta;
+	size_t header_size, size, arena_size = 0;
+
+	ULOG_ERRNO_RETURN_VAL_IF(buf == NULL, EINVAL, NULL);
+	ULOG_ERRNO_RETURN_VAL_IF(key == NULL, EINVAL, NULL);
+	ULOG_ERRNO_RETURN_VAL_IF(len == 0, EINVAL, NULL);
+
+	/* The metadata entry and its data (unless it is in a data block)
+	 * are allocated as a single block, in the buffer metadata arena if
+	 * there is enough room left */
+	header_size = vbuf_align_size(sizeof(*meta), VBUF_META_ALIGN);
+	size = (blob != NULL) ? header_size : header_size + len;
+	if (vbuf_align_size(size, VBUF_META_ALIGN) <=
+	    buf->meta_arena_capacity - buf->meta_arena_used) {
+		arena_size = vbuf_align_size(size, VBUF_META_ALIGN);
+		meta = (struct vbuf_meta *)(buf->meta_arena +
+					    buf->meta_arena_used);
+		buf->meta_arena_used += arena_size;
+		memset(meta, 0, size);
+	} else {
+		meta = calloc(1, size);
+		if (meta == NULL) {
+			ULOG_ERRNO("calloc:meta", ENOMEM);
+			return NULL;
+		}
+	}
+	list_node_unref(&meta->node);
+	meta->key = key;
+	meta->level = level;
+	meta->arena_size = arena_size;
+	meta->len = len;
+	if (blob != NULL) {
+		vbuf_meta_blob_ref(blob);
+		meta->blob = blob;
+		meta->data = blob->data;
+	} else {
+		meta->data = (uint8_t *)meta + header_size;
+	}
+
+	return meta;
+}
+
+
+int vbuf_meta_destroy(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(meta == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(!list_node_is_unref(&meta->node), EBUSY);
+
+	if (meta->blob != NULL)
+		vbuf_meta_blob_unuse(meta->blob);
+
+	if ((meta->arena_size == 0) || (meta->blob != NULL)) {
+		/* Lock-free readers may still access the entry or its data
+		 * block, it is released when the buffer metadata is
+		 * cleared */
+		list_add_before(&buf->meta_retired, &meta->node);
+		return 0;
+	}
+
+	/* Arena space is only reclaimed when the buffer metadata is cleared,
+	 * unless the entry is the last one allocated */
+	if ((uint8_t *)meta + meta->arena_size ==
+	    buf->meta_arena + buf->meta_arena_used)
+		buf->meta_arena_used -= meta->arena_size;
+
+	return 0;
+}
+
+
+/* Release a metadata entry that is no longer accessed by lock-free
+ * readers */
+static void vbuf_meta_release(struct vbuf_meta *meta)
+{
+	if (meta->blob != NULL)
+		vbuf_meta_blob_unref(meta->blob);
+	meta->blob = NULL;
+	if (meta->arena_size == 0)
+		free(meta);
+}
+
+
+void vbuf_meta_clear(struct vbuf_buffer *buf)
+{
+	struct vbuf_meta *meta = NULL, *tmp_meta = NULL;
+	struct vbuf_meta_index *index;
+
+	/* The buffer is no longer referenced: there are no concurrent
+	 * readers and the retired memory can be freed */
+	list_walk_entry_forward_safe(&buf->metas, meta, tmp_meta, node)
+	{
+		list_del(&meta->node);
+		if (meta->blob != NULL)
+			vbuf_meta_blob_unuse(meta->blob);
+		vbuf_meta_release(meta);
+	}
+	list_walk_entry_forward_safe(&buf->meta_retired, meta, tmp_meta, node)
+	{
+		list_del(&meta->node);
+		vbuf_meta_release(meta);
+	}
+	while (buf->meta_index_retired != NULL) {
+		index = buf->meta_index_retired;
+		buf->meta_index_retired = index->retired;
+		free(index);
+	}
+
+	/* Reset the arena and the index */
+	buf->meta_count = 0;
+	buf->meta_arena_used = 0;
+	if (buf->meta_index_used > 0) {
+		memset(buf->meta_index->slots,
+		       0,
+		       buf->meta_index->size * sizeof(*buf->meta_index->slots));
+		buf->meta_index_used = 0;
+	}
+}
+
+
+/* Start a metadata modification (the buffer mutex must be held) */
+static inline void vbuf_meta_write_begin(struct vbuf_buffer *buf)
+{
+	__atomic_store_n(&buf->meta_seq, buf->meta_seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+
+/* End a metadata modification (the buffer mutex must be held) */
+static inline void vbuf_meta_write_end(struct vbuf_buffer *buf)
+{
+	__atomic_store_n(&buf->meta_seq, buf->meta_seq + 1, __ATOMIC_RELEASE);
+}
+
+
+/* Replace the data of a metadata entry (the buffer mutex must be held);
+ * the previous data block, if any, is kept until the buffer metadata is
+ * cleared, so that pointers previously obtained on it remain valid */
+static int vbuf_meta_set_blob(struct vbuf_buffer *buf,
+			      struct vbuf_meta *meta,
+			      struct vbuf_meta_blob *blob)
+{
+	struct vbuf_meta *retired;
+
+	if (meta->blob != NULL) {
+		retired = calloc(1, sizeof(*retired));
+		if (retired == NULL) {
+			ULOG_ERRNO("calloc:meta", ENOMEM);
+			return -ENOMEM;
+		}
+		retired->blob = meta->blob;
+		list_add_before(&buf->meta_retired, &retired->node);
+		vbuf_meta_blob_unuse(meta->blob);
+	}
+
+	/* The data is set before being published to lock-free readers */
+	__atomic_store_n(&meta->blob, blob, __ATOMIC_RELAXED);
+	__atomic_store_n(&meta->data, blob->data, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+/* Move the data of a metadata entry to a data block so that it can be
+ * shared with other buffers (the buffer mutex must be held, and the data
+ * becomes read-only) */
+static int vbuf_meta_share(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	int res;
+	struct vbuf_meta_blob *blob;
+
+	if (meta->blob != NULL)
+		return 0;
+
+	blob = vbuf_meta_blob_new(meta->data, meta->len);
+	if (blob == NULL)
+		return -ENOMEM;
+
+	res = vbuf_meta_set_blob(buf, meta, blob);
+	if (res < 0)
+		vbuf_meta_blob_unref(blob);
+
+	return res;
+}
+
+
+/* Give a metadata entry a private copy of its shared data block (the
+ * buffer mutex must be held) */
+static int vbuf_meta_unshare(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	int res;
+	struct vbuf_meta_blob *blob;
+
+	if ((meta->blob == NULL) || (!vbuf_meta_blob_is_shared(meta->blob)))
+		return 0;
+
+	blob = vbuf_meta_blob_new(meta->data, meta->len);
+	if (blob == NULL)
+		return -ENOMEM;
+
+	res = vbuf_meta_set_blob(buf, meta, blob);
+	if (res < 0)
+		vbuf_meta_blob_unref(blob);
+
+	return res;
+}
+
+
+static inline unsigned int vbuf_meta_hash(void *key)
+{
+	/* Fibonacci hashing of the key pointer */
+	uint64_t h = (uint64_t)(uintptr_t)key * 0x9E3779B97F4A7C15ULL;
+	return (unsigned int)(h >> 32);
+}
+
+
+/* Rebuild the metadata index with a given size from the metadata list */
+static int vbuf_meta_index_resize(struct vbuf_buffer *buf, unsigned int size)
+{
+	struct vbuf_meta_index *index;
+	struct vbuf_meta *meta;
+	unsigned int i, mask = size - 1;
+
+	index = calloc(1, sizeof(*index) + size * sizeof(*index->slots));
+	if (index == NULL) {
+		ULOG_ERRNO("calloc:index", ENOMEM);
+		return -ENOMEM;
+	}
+	index->size = size;
+
+	list_walk_entry_forward(&buf->metas, meta, node)
+	{
+		i = vbuf_meta_hash(meta->key) & mask;
+		while (index->slots[i] != NULL)
+			i = (i + 1) & mask;
+		index->slots[i] = meta;
+	}
+
+	/* Publish the new index, the previous one is retired */
+	if (buf->meta_index != NULL) {
+		buf->meta_index->retired = buf->meta_index_retired;
+		buf->meta_index_retired = buf->meta_index;
+	}
+	__atomic_store_n(&buf->meta_index, index, __ATOMIC_RELEASE);
+	buf->meta_index_used = buf->meta_count;
+
+	return 0;
+}
+
+
+/* Add an entry to the metadata index; the entry must not be in the index
+ * already and must already be in the metadata list */
+int vbuf_meta_index_add(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	int res;
+	unsigned int i, mask, size;
+	struct vbuf_meta_index *index = buf->meta_index;
+
+	/* Keep the load factor (including removed entries) under 3/4 */
+	if ((index == NULL) ||
+	    ((buf->meta_index_used + 1) * 4 > index->size * 3)) {
+		size = VBUF_META_INDEX_MIN_SIZE;
+		while (buf->meta_count * 2 > size)
+			size *= 2;
+		res = vbuf_meta_index_resize(buf, size);
+		if (res < 0)
+			return res;
+		/* The entry was added by the index rebuild */
+		return 0;
+	}
+
+	mask = index->size - 1;
+	i = vbuf_meta_hash(meta->key) & mask;
+	while ((index->slots[i] != NULL) &&
+	       (index->slots[i] != &s_meta_removed))
+		i = (i + 1) & mask;
+	if (index->slots[i] == NULL)
+		buf->meta_index_used++;
+	__atomic_store_n(&index->slots[i], meta, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+
+/* Find the index slot of a metadata key */
+static struct vbuf_meta **vbuf_meta_index_find(struct vbuf_buffer *buf,
+					       void *key)
+{
+	unsigned int i, mask;
+	struct vbuf_meta *meta;
+	struct vbuf_meta_index *index = buf->meta_index;
+
+	if (index == NULL)
+		return NULL;
+
+	mask = index->size - 1;
+	i = vbuf_meta_hash(key) & mask;
+	while ((meta = index->slots[i]) != NULL) {
+		if ((meta != &s_meta_removed) && (meta->key == key))
+			return &index->slots[i];
+		i = (i + 1) & mask;
+	}
+
+	return NULL;
+}
+
+
+void vbuf_meta_index_remove(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	struct vbuf_meta **slot = vbuf_meta_index_find(buf, meta->key);
+
+	if (slot != NULL)
+		__atomic_store_n(slot, &s_meta_removed, __ATOMIC_RELEASE);
+}
+
+
+struct vbuf_meta *vbuf_meta_find(struct vbuf_buffer *buf, void *key)
+{
+	struct vbuf_meta **slot;
+
+	ULOG_ERRNO_RETURN_VAL_IF(buf == NULL, EINVAL, NULL);
+	ULOG_ERRNO_RETURN_VAL_IF(key == NULL, EINVAL, NULL);
+
+	slot = vbuf_meta_index_find(buf, key);
+
+	return (slot != NULL) ? *slot : NULL;
+}
+
+
+/* Insert a new entry in the metadata list and index (the buffer mutex
+ * must be held and a modification must be in progress); the entry is
+ * destroyed on failure */
+static int vbuf_meta_insert(struct vbuf_buffer *buf, struct vbuf_meta *meta)
+{
+	int res;
+
+	list_add_before(&buf->metas, &meta->node);
+	buf->meta_count++;
+	res = vbuf_meta_index_add(buf, meta);
+	if (res < 0) {
+		list_del(&meta->node);
+		buf->meta_count--;
+		vbuf_meta_destroy(buf, meta);
+		return res;
+	}
+
+	return 0;
+}
+
+
+/* Lock-free metadata lookup; returns -EAGAIN if the metadata was modified
+ * concurrently, in which case the output values must be ignored */
+static int vbuf_meta_read(struct vbuf_buffer *buf,
+			  void *key,
+			  unsigned int *level,
+			  size_t *len,
+			  uint8_t **data,
+			  int *shared)
+{
+	struct vbuf_meta_blob *blob;
+	int res = -ENOENT;
+	unsigned int seq, i, n, mask;
+	struct vbuf_meta_index *index;
+	struct vbuf_meta *meta;
+
+	seq = __atomic_load_n(&buf->meta_seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+		return -EAGAIN;
+
+	index = __atomic_load_n(&buf->meta_index, __ATOMIC_ACQUIRE);
+	if (index != NULL) {
+		/* Retired indexes and entries are not freed while the buffer
+		 * is referenced, the probe count is bounded in case of
+		 * an inconsistent snapshot */
+		mask = index->size - 1;
+		i = vbuf_meta_hash(key) & mask;
+		for (n = 0; n < index->size; n++) {
+			meta = __atomic_load_n(&index->slots[i],
+					       __ATOMIC_ACQUIRE);
+			if (meta == NULL)
+				break;
+			if ((meta != &s_meta_removed) &&
+			    (__atomic_load_n(&meta->key, __ATOMIC_RELAXED) ==
+			     key)) {
+				*level = __atomic_load_n(&meta->level,
+							 __ATOMIC_RELAXED);
+				*len = __atomic_load_n(&meta->len,
+						       __ATOMIC_RELAXED);
+				*data = __atomic_load_n(&meta->data,
+							__ATOMIC_ACQUIRE);
+				/* Data blocks of an entry are not freed while
+				 * the buffer is referenced */
+				blob = __atomic_load_n(&meta->blob,
+						       __ATOMIC_RELAXED);
+				*shared = (blob != NULL) &&
+					  vbuf_meta_blob_is_shared(blob);
+				res = 0;
+				break;
+			}
+			i = (i + 1) & mask;
 		}
 	}
 
-	return (found) ? meta : NULL;
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&buf->meta_seq, __ATOMIC_RELAXED) != seq)
+		return -EAGAIN;
+
+	return res;
+}
+
+
+/* Metadata lookup; when writable is not null, shared data is copied
+ * to a private data block */
+static int vbuf_meta_lookup(struct vbuf_buffer *buf,
+			    void *key,
+			    int writable,
+			    unsigned int *level,
+			    size_t *len,
+			    uint8_t **data)
+{
+	int res = -EAGAIN, i, shared = 0;
+	struct vbuf_meta *meta;
+
+	for (i = 0; (i < VBUF_META_READ_RETRIES) && (res == -EAGAIN); i++)
+		res = vbuf_meta_read(buf, key, level, len, data, &shared);
+	if ((res != -EAGAIN) && ((res < 0) || (!writable) || (!shared)))
+		return res;
+
+	/* Concurrent modifications or shared data, use a locked lookup */
+	VBUF_MUTEX_LOCK(&buf->mutex);
+
+	meta = vbuf_meta_find(buf, key);
+	if (meta == NULL) {
+		res = -ENOENT;
+		goto out;
+	}
+
+	if (writable) {
+		vbuf_meta_write_begin(buf);
+		res = vbuf_meta_unshare(buf, meta);
+		vbuf_meta_write_end(buf);
+		if (res < 0)
+			goto out;
+	}
+
+	*level = meta->level;
+	*len = meta->len;
+	*data = meta->data;
+	res = 0;
+
+out:
+	VBUF_MUTEX_UNLOCK(&buf->mutex);
+	return res;
 }
 
 
@@ -448,18 +2109,22 @@ int vbuf_metadata_add(struct vbuf_buffer *buf,
 		return res;
 	}
 
-	meta = vbuf_meta_new(key, level, len);
+	vbuf_meta_write_begin(buf);
+
+	meta = vbuf_meta_new(buf, key, level, len, NULL);
 	if (meta == NULL) {
-		VBUF_MUTEX_UNLOCK(&buf->mutex);
-		return -ENOMEM;
+		res = -ENOMEM;
+		goto out;
 	}
 
-	list_add_before(&buf->metas, &meta->node);
+	res = vbuf_meta_insert(buf, meta);
+	if (res == 0)
+		*ret_ptr = meta->data;
 
+out:
+	vbuf_meta_write_end(buf);
 	VBUF_MUTEX_UNLOCK(&buf->mutex);
-
-	*ret_ptr = meta->data;
-	return 0;
+	return res;
 }
 
 
@@ -470,29 +2135,56 @@ int vbuf_metadata_get(struct vbuf_buffer *buf,
 		      uint8_t **ret_ptr)
 {
 	int res;
-	struct vbuf_meta *meta;
+	unsigned int _level = 0;
+	size_t _len = 0;
+	uint8_t *data = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(key == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(ret_ptr == NULL, EINVAL);
 
-	VBUF_MUTEX_LOCK(&buf->mutex);
+	res = vbuf_meta_lookup(buf, key, 1, &_level, &_len, &data);
+	if (res < 0) {
+		ULOG_ERRNO("metadata %p not found", -res, key);
+		return res;
+	}
 
-	meta = vbuf_meta_find(buf, key);
+	if (level)
+		*level = _level;
+	if (len)
+		*len = _len;
+	*ret_ptr = data;
 
-	VBUF_MUTEX_UNLOCK(&buf->mutex);
+	return 0;
+}
 
-	if (meta == NULL) {
-		res = -ENOENT;
+
+int vbuf_metadata_cget(struct vbuf_buffer *buf,
+		       void *key,
+		       unsigned int *level,
+		       size_t *len,
+		       const uint8_t **ret_ptr)
+{
+	int res;
+	unsigned int _level = 0;
+	size_t _len = 0;
+	uint8_t *data = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(key == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_ptr == NULL, EINVAL);
+
+	res = vbuf_meta_lookup(buf, key, 0, &_level, &_len, &data);
+	if (res < 0) {
 		ULOG_ERRNO("metadata %p not found", -res, key);
 		return res;
 	}
 
 	if (level)
-		*level = meta->level;
+		*level = _level;
 	if (len)
-		*len = meta->len;
-	*ret_ptr = meta->data;
+		*len = _len;
+	*ret_ptr = data;
 
 	return 0;
 }
@@ -516,50 +2208,94 @@ int vbuf_metadata_remove(struct vbuf_buffer *buf, void *key)
 		return res;
 	}
 
+	vbuf_meta_write_begin(buf);
+	vbuf_meta_index_remove(buf, meta);
 	list_del(&meta->node);
+	buf->meta_count--;
+	vbuf_meta_destroy(buf, meta);
+	vbuf_meta_write_end(buf);
 
 	VBUF_MUTEX_UNLOCK(&buf->mutex);
 
-	vbuf_meta_destroy(meta);
-
 	return 0;
 }
 
 
+void vbuf_meta_remove_all(struct vbuf_buffer *buf)
+{
+	struct vbuf_meta *meta = NULL, *tmp_meta = NULL;
+
+	VBUF_MUTEX_LOCK(&buf->mutex);
+
+	vbuf_meta_write_begin(buf);
+	list_walk_entry_forward_safe(&buf->metas, meta, tmp_meta, node)
+	{
+		vbuf_meta_index_remove(buf, meta);
+		list_del(&meta->node);
+		buf->meta_count--;
+		vbuf_meta_destroy(buf, meta);
+	}
+	vbuf_meta_write_end(buf);
+
+	VBUF_MUTEX_UNLOCK(&buf->mutex);
+}
+
+
 int vbuf_metadata_copy(struct vbuf_buffer *src_buf,
 		       struct vbuf_buffer *dst_buf,
 		       unsigned int max_level)
 {
-	int res;
-	struct vbuf_meta *src_meta;
-	uint8_t *dst_meta;
+	int res = 0;
+	struct vbuf_meta *src_meta, *dst_meta;
 
 	ULOG_ERRNO_RETURN_ERR_IF(src_buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(dst_buf == src_buf, EINVAL);
 
 	VBUF_MUTEX_LOCK(&src_buf->mutex);
+	VBUF_MUTEX_LOCK(&dst_buf->mutex);
+	vbuf_meta_write_begin(src_buf);
+	vbuf_meta_write_begin(dst_buf);
 
 	list_walk_entry_forward(&src_buf->metas, src_meta, node)
 	{
-		if ((max_level == 0) || (src_meta->level < max_level)) {
-			res = vbuf_metadata_add(dst_buf,
-						src_meta->key,
-						src_meta->level,
-						src_meta->len,
-						&dst_meta);
-			if (res < 0) {
-				VBUF_MUTEX_UNLOCK(&src_buf->mutex);
-				ULOG_ERRNO("vbuf_metadata_add", -res);
-				return res;
-			}
-			memcpy(dst_meta, src_meta->data, src_meta->len);
+		if ((max_level != 0) && (src_meta->level >= max_level))
+			continue;
+
+		if (vbuf_meta_find(dst_buf, src_meta->key) != NULL) {
+			res = -EEXIST;
+			ULOG_ERRNO("metadata %p already exists",
+				   -res,
+				   src_meta->key);
+			break;
+		}
+
+		/* The data block is shared between the source and the
+		 * destination buffers, it is copied when a writable pointer
+		 * is requested on either side */
+		res = vbuf_meta_share(src_buf, src_meta);
+		if (res < 0)
+			break;
+		dst_meta = vbuf_meta_new(dst_buf,
+					 src_meta->key,
+					 src_meta->level,
+					 src_meta->len,
+					 src_meta->blob);
+		if (dst_meta == NULL) {
+			res = -ENOMEM;
+			break;
 		}
+		res = vbuf_meta_insert(dst_buf, dst_meta);
+		if (res < 0)
+			break;
 	}
 
+	vbuf_meta_write_end(dst_buf);
+	vbuf_meta_write_end(src_buf);
+	VBUF_MUTEX_UNLOCK(&dst_buf->mutex);
 	VBUF_MUTEX_UNLOCK(&src_buf->mutex);
 
-	return 0;
+	return res;
 }
 
 
@@ -596,7 +2332,18 @@ ssize_t vbuf_set_userdata_capacity(struct vbuf_buffer *buf, size_t capacity)
 	ULOG_ERRNO_RETURN_ERR_IF(buf->write_locked, EPERM);
 
 	if (capacity > buf->userdata_capacity) {
-		uint8_t *tmp = realloc(buf->userdata_ptr, capacity);
+		uint8_t *tmp;
+		if (buf->userdata_inline) {
+			/* Move the user data out of the buffer object block */
+			tmp = malloc(capacity);
+			if (tmp != NULL) {
+				memcpy(tmp,
+				       buf->userdata_ptr,
+				       buf->userdata_capacity);
+			}
+		} else {
+			tmp = realloc(buf->userdata_ptr, capacity);
+		}
 		if (tmp == NULL) {
 			res = -ENOMEM;
 			ULOG_ERRNO("calloc", -res);
@@ -605,6 +2352,7 @@ ssize_t vbuf_set_userdata_capacity(struct vbuf_buffer *buf, size_t capacity)
 
 		buf->userdata_ptr = tmp;
 		buf->userdata_capacity = capacity;
+		buf->userdata_inline = 0;
 	}
 
 	return (ssize_t)buf->userdata_capacity;
@@ -647,9 +2395,9 @@ int vbuf_userdata_copy(struct vbuf_buffer *src_buf, struct vbuf_buffer *dst_buf)
 	if (res < 0)
 		return res;
 
-	memcpy(dst_buf->userdata_ptr,
-	       src_buf->userdata_ptr,
-	       src_buf->userdata_size);
+	vbuf_memcpy(dst_buf->userdata_ptr,
+		    src_buf->userdata_ptr,
+		    src_buf->userdata_size);
 	res = vbuf_set_userdata_size(dst_buf, src_buf->userdata_size);
 	return res;
 }
@@ -0,0 +1,316 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_priv.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#	define VBUF_COPY_X86
+#	include <immintrin.h>
+#endif
+
+
+/* Non-temporal copy kernel (NULL if not available on this CPU); the
+ * streaming stores must be followed by a call to vbuf_memcpy_fence() */
+static void (*s_memcpy_nt)(uint8_t *dst, const uint8_t *src, size_t len);
+static pthread_once_t s_memcpy_once = PTHREAD_ONCE_INIT;
+
+
+#ifdef VBUF_COPY_X86
+
+/* Copy the unaligned head of the destination with memcpy; returns the
+ * copied length */
+static inline size_t
+vbuf_memcpy_head(uint8_t *dst, const uint8_t *src, size_t len, size_t align)
+{
+	size_t head = (size_t)(-(uintptr_t)dst) & (align - 1);
+
+	if (head > len)
+		head = len;
+	memcpy(dst, src, head);
+
+	return head;
+}
+
+
+__attribute__((target("sse2"))) static void
+vbuf_memcpy_nt_sse2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t head = vbuf_memcpy_head(dst, src, len, 16);
+	__m128i a, b, c, d;
+
+	dst += head;
+	src += head;
+	len -= head;
+	for (; len >= 64; len -= 64, dst += 64, src += 64) {
+		a = _mm_loadu_si128((const __m128i *)src);
+		b = _mm_loadu_si128((const __m128i *)(src + 16));
+		c = _mm_loadu_si128((const __m128i *)(src + 32));
+		d = _mm_loadu_si128((const __m128i *)(src + 48));
+		_mm_stream_si128((__m128i *)dst, a);
+		_mm_stream_si128((__m128i *)(dst + 16), b);
+		_mm_stream_si128((__m128i *)(dst + 32), c);
+		_mm_stream_si128((__m128i *)(dst + 48), d);
+	}
+	memcpy(dst, src, len);
+}
+
+
+__attribute__((target("avx2"))) static void
+vbuf_memcpy_nt_avx2(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t head = vbuf_memcpy_head(dst, src, len, 32);
+	__m256i a, b, c, d;
+
+	dst += head;
+	src += head;
+	len -= head;
+	for (; len >= 128; len -= 128, dst += 128, src += 128) {
+		a = _mm256_loadu_si256((const __m256i *)src);
+		b = _mm256_loadu_si256((const __m256i *)(src + 32));
+		c = _mm256_loadu_si256((const __m256i *)(src + 64));
+		d = _mm256_loadu_si256((const __m256i *)(src + 96));
+		_mm256_stream_si256((__m256i *)dst, a);
+		_mm256_stream_si256((__m256i *)(dst + 32), b);
+		_mm256_stream_si256((__m256i *)(dst + 64), c);
+		_mm256_stream_si256((__m256i *)(dst + 96), d);
+	}
+	memcpy(dst, src, len);
+}
+
+
+__attribute__((target("avx512f"))) static void
+vbuf_memcpy_nt_avx512(uint8_t *dst, const uint8_t *src, size_t len)
+{
+	size_t head = vbuf_memcpy_head(dst, src, len, 64);
+	__m512i a, b, c, d;
+
+	dst += head;
+	src += head;
+	len -= head;
+	for (; len >= 256; len -= 256, dst += 256, src += 256) {
+		a = _mm512_loadu_si512((const void *)src);
+		b = _mm512_loadu_si512((const void *)(src + 64));
+		c = _mm512_loadu_si512((const void *)(src + 128));
+		d = _mm512_loadu_si512((const void *)(src + 192));
+		_mm512_stream_si512((void *)dst, a);
+		_mm512_stream_si512((void *)(dst + 64), b);
+		_mm512_stream_si512((void *)(dst + 128), c);
+		_mm512_stream_si512((void *)(dst + 192), d);
+	}
+	memcpy(dst, src, len);
+}
+
+/* Order the streaming stores before any later store */
+__attribute__((target("sse2"))) static void vbuf_memcpy_fence(void)
+{
+	_mm_sfence();
+}
+
+#else /* !VBUF_COPY_X86 */
+
+static void vbuf_memcpy_fence(void)
+{
+}
+
+#endif /* !VBUF_COPY_X86 */
+
+
+/* True if a copy kernel is allowed by the VBUF_COPY_KERNEL environment
+ * variable (all kernels are allowed if it is not set) */
+#define VBUF_COPY_KERNEL_ALLOWED(_forced, _name)                               \
+	(((_forced) == NULL) || (strcmp((_forced), (_name)) == 0))
+
+
+/* The kernel can be forced with the VBUF_COPY_KERNEL environment variable
+ * ("memcpy", "sse2", "avx2" or "avx512") for testing and benchmarking;
+ * memcpy is used if the forced kernel is not available */
+static void vbuf_memcpy_init(void)
+{
+	const char *forced = getenv("VBUF_COPY_KERNEL");
+
+	if (forced != NULL)
+		ULOGI("forced copy kernel: %s", forced);
+
+#ifdef VBUF_COPY_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx512f") &&
+	    VBUF_COPY_KERNEL_ALLOWED(forced, "avx512"))
+		s_memcpy_nt = vbuf_memcpy_nt_avx512;
+	else if (__builtin_cpu_supports("avx2") &&
+		 VBUF_COPY_KERNEL_ALLOWED(forced, "avx2"))
+		s_memcpy_nt = vbuf_memcpy_nt_avx2;
+	else if (__builtin_cpu_supports("sse2") &&
+		 VBUF_COPY_KERNEL_ALLOWED(forced, "sse2"))
+		s_memcpy_nt = vbuf_memcpy_nt_sse2;
+#endif /* VBUF_COPY_X86 */
+}
+
+
+/* Get the non-temporal copy kernel if it should be used for a copy of
+ * len bytes, NULL otherwise */
+static void (*vbuf_memcpy_get_nt(size_t len))(uint8_t *dst,
+					       const uint8_t *src,
+					       size_t len)
+{
+	/* Small copies are likely to be consumed soon: keep them in the
+	 * cache with a regular memcpy */
+	if (len < VBUF_COPY_NT_THRESHOLD)
+		return NULL;
+
+	pthread_once(&s_memcpy_once, vbuf_memcpy_init);
+
+	return s_memcpy_nt;
+}
+
+
+void vbuf_memcpy(void *dst, const void *src, size_t len)
+{
+	void (*nt)(uint8_t *dst, const uint8_t *src, size_t len);
+
+	nt = vbuf_memcpy_get_nt(len);
+	if (nt != NULL) {
+		(*nt)(dst, src, len);
+		vbuf_memcpy_fence();
+	} else {
+		memcpy(dst, src, len);
+	}
+}
+
+
+/* 2D copy band: a range of rows copied by a worker */
+struct vbuf_memcpy_2d_band {
+	struct vbuf_work work;
+	void (*nt)(uint8_t *dst, const uint8_t *src, size_t len);
+	uint8_t *dst;
+	size_t dst_stride;
+	const uint8_t *src;
+	size_t src_stride;
+	size_t width;
+	size_t height;
+	/* Shared completion state */
+	pthread_mutex_t *mutex;
+	pthread_cond_t *cond;
+	unsigned int *pending;
+};
+
+
+static void vbuf_memcpy_2d_rows(struct vbuf_memcpy_2d_band *band)
+{
+	size_t i;
+	uint8_t *dst = band->dst;
+	const uint8_t *src = band->src;
+
+	for (i = 0; i < band->height; i++) {
+		if (band->nt != NULL)
+			(*band->nt)(dst, src, band->width);
+		else
+			memcpy(dst, src, band->width);
+		dst += band->dst_stride;
+		src += band->src_stride;
+	}
+	if (band->nt != NULL)
+		vbuf_memcpy_fence();
+}
+
+
+static void vbuf_memcpy_2d_band_run(struct vbuf_work *work)
+{
+	struct vbuf_memcpy_2d_band *band =
+		list_entry(work, struct vbuf_memcpy_2d_band, work);
+
+	vbuf_memcpy_2d_rows(band);
+
+	VBUF_MUTEX_LOCK(band->mutex);
+	(*band->pending)--;
+	if (*band->pending == 0)
+		VBUF_COND_SIGNAL(band->cond);
+	VBUF_MUTEX_UNLOCK(band->mutex);
+}
+
+
+void vbuf_memcpy_2d(uint8_t *dst,
+		    size_t dst_stride,
+		    const uint8_t *src,
+		    size_t src_stride,
+		    size_t width,
+		    size_t height)
+{
+	unsigned int i, count = 1, pending;
+	size_t rows, total = width * height;
+	pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t cond = PTHREAD_COND_INITIALIZER;
+	struct vbuf_memcpy_2d_band bands[VBUF_WORKER_MAX_COUNT];
+
+	if ((width == 0) || (height == 0))
+		return;
+
+	/* Contiguous rows: single copy */
+	if ((dst_stride == width) && (src_stride == width)) {
+		vbuf_memcpy(dst, src, total);
+		return;
+	}
+
+	/* Split the rows in bands across the workers for large copies; the
+	 * calling thread copies the first band */
+	if (total >= VBUF_COPY_MT_THRESHOLD)
+		count = vbuf_worker_get_count();
+	if (count > height)
+		count = height;
+	rows = (height + count - 1) / count;
+	count = (height + rows - 1) / rows;
+	pending = count - 1;
+	for (i = 0; i < count; i++) {
+		bands[i].work.fn = vbuf_memcpy_2d_band_run;
+		bands[i].nt = vbuf_memcpy_get_nt(total);
+		bands[i].dst = dst + i * rows * dst_stride;
+		bands[i].dst_stride = dst_stride;
+		bands[i].src = src + i * rows * src_stride;
+		bands[i].src_stride = src_stride;
+		bands[i].width = width;
+		bands[i].height = (i < count - 1) ? rows : height - i * rows;
+		bands[i].mutex = &mutex;
+		bands[i].cond = &cond;
+		bands[i].pending = &pending;
+	}
+	for (i = 1; i < count; i++)
+		vbuf_worker_submit(&bands[i].work);
+	vbuf_memcpy_2d_rows(&bands[0]);
+
+	/* Copy the bands that no worker has started yet (the workers may
+	 * be busy, or this function may be called from a worker) */
+	for (i = 1; i < count; i++) {
+		if (vbuf_worker_cancel(&bands[i].work))
+			vbuf_memcpy_2d_band_run(&bands[i].work);
+	}
+
+	/* Wait for the other bands */
+	VBUF_MUTEX_LOCK(&mutex);
+	while (pending > 0)
+		VBUF_COND_WAIT(&cond, &mutex);
+	VBUF_MUTEX_UNLOCK(&mutex);
+	pthread_mutex_destroy(&mutex);
+	pthread_cond_destroy(&cond);
+}
@@ -24,35 +24,989 @@
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE
+#endif
+#include <sched.h>
+
 #include "vbuf_priv.h"
 
 
+/* Lock-free free list: add a buffer to the ring (bounded MPMC queue);
+ * the ring has room for all the pool buffers, so it is never full */
+static void vbuf_pool_ring_push(struct vbuf_pool *pool, struct vbuf_buffer *buf)
+{
+	struct vbuf_pool_slot *slot;
+	unsigned long pos, seq;
+	long diff;
+
+#if defined(__GNUC__)
+	pos = __atomic_load_n(&pool->ring_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &pool->ring[pos & pool->ring_mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - pos);
+		if (diff == 0) {
+			/* The slot is empty, try to claim it */
+			if (__atomic_compare_exchange_n(&pool->ring_tail,
+							&pos,
+							pos + 1,
+							1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The slot is still being dequeued, wait for it */
+			sched_yield();
+			pos = __atomic_load_n(&pool->ring_tail,
+					      __ATOMIC_RELAXED);
+		} else {
+			/* Another thread claimed the slot, reload */
+			pos = __atomic_load_n(&pool->ring_tail,
+					      __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Publish the buffer */
+	__atomic_store_n(&slot->buf, buf, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+#else
+#	error no atomic functions found on this platform
+#endif
+}
+
+
+/* Lock-free free list: remove a buffer from the ring (bounded MPMC
+ * queue); the buffer must have been reserved in the free count (see
+ * vbuf_pool_free_reserve()), so the ring is never empty */
+static struct vbuf_buffer *vbuf_pool_ring_pop(struct vbuf_pool *pool)
+{
+	struct vbuf_pool_slot *slot;
+	struct vbuf_buffer *buf;
+	unsigned long pos, seq;
+	long diff;
+
+#if defined(__GNUC__)
+	pos = __atomic_load_n(&pool->ring_head, __ATOMIC_RELAXED);
+	for (;;) {
+		slot = &pool->ring[pos & pool->ring_mask];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - (pos + 1));
+		if (diff == 0) {
+			/* The slot is full, try to claim it */
+			if (__atomic_compare_exchange_n(&pool->ring_head,
+							&pos,
+							pos + 1,
+							1,
+							__ATOMIC_RELAXED,
+							__ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/* The slot is still being enqueued, wait for it */
+			sched_yield();
+			pos = __atomic_load_n(&pool->ring_head,
+					      __ATOMIC_RELAXED);
+		} else {
+			/* Another thread claimed the slot, reload */
+			pos = __atomic_load_n(&pool->ring_head,
+					      __ATOMIC_RELAXED);
+		}
+	}
+
+	/* Release the slot for the next round of enqueue positions */
+	buf = __atomic_load_n(&slot->buf, __ATOMIC_RELAXED);
+	__atomic_store_n(&slot->seq, pos + pool->ring_mask + 1, __ATOMIC_RELEASE);
+#else
+#	error no atomic functions found on this platform
+#endif
+
+	return buf;
+}
+
+
+/* Lock-free free list: get the buffer at the head of the ring without
+ * removing it (NULL if the ring is empty); the buffer may be removed by
+ * another thread at any time */
+static struct vbuf_buffer *vbuf_pool_ring_peek(struct vbuf_pool *pool)
+{
+	struct vbuf_pool_slot *slot;
+	struct vbuf_buffer *buf;
+	unsigned long pos;
+
+#if defined(__GNUC__)
+	pos = __atomic_load_n(&pool->ring_head, __ATOMIC_RELAXED);
+	slot = &pool->ring[pos & pool->ring_mask];
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != pos + 1)
+		return NULL;
+	buf = __atomic_load_n(&slot->buf, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+
+	return buf;
+}
+
+
+/* Lock-free free list: reserve up to count buffers in the free count,
+ * which only includes the buffers published in the ring; returns the
+ * number of buffers reserved */
+static unsigned int vbuf_pool_free_reserve(struct vbuf_pool *pool,
+					   unsigned int count)
+{
+	unsigned int free, n;
+
+#if defined(__GNUC__)
+	free = __atomic_load_n(&pool->free, __ATOMIC_SEQ_CST);
+	do {
+		if (free == 0)
+			return 0;
+		n = (free < count) ? free : count;
+	} while (!__atomic_compare_exchange_n(&pool->free,
+					      &free,
+					      free - n,
+					      1,
+					      __ATOMIC_SEQ_CST,
+					      __ATOMIC_SEQ_CST));
+#else
+#	error no atomic compare and exchange function found on this platform
+#endif
+
+	return n;
+}
+
+
+/* Lock-free free list: create the ring for the pool buffer count */
+static int vbuf_pool_ring_init(struct vbuf_pool *pool)
+{
+	unsigned long i, size = 1;
+
+	while (size < pool->max_count)
+		size <<= 1;
+
+	pool->ring = calloc(size, sizeof(*pool->ring));
+	if (pool->ring == NULL) {
+		ULOG_ERRNO("calloc:ring", ENOMEM);
+		return -ENOMEM;
+	}
+	pool->ring_mask = size - 1;
+	for (i = 0; i < size; i++)
+		pool->ring[i].seq = i;
+
+	return 0;
+}
+
+
+/* Destroy all the free buffers of the pool */
+static void vbuf_pool_destroy_buffers(struct vbuf_pool *pool)
+{
+	struct vbuf_buffer *buf = NULL, *tmp_buf = NULL;
+
+	if (pool->lock_free) {
+		if (pool->ring == NULL)
+			return;
+		while (pool->free > 0) {
+			pool->free--;
+			buf = vbuf_pool_ring_pop(pool);
+			vbuf_destroy(buf);
+		}
+		return;
+	}
+
+	list_walk_entry_forward_safe(&pool->buffers, buf, tmp_buf, node)
+	{
+		list_del(&buf->node);
+		pool->free--;
+		vbuf_destroy(buf);
+	}
+}
+
+
+/* Lock-free free list: get a buffer, only locking the pool mutex when
+ * waiting for a buffer to be returned */
+static int vbuf_pool_get_lock_free(struct vbuf_pool *pool,
+				   int timeout_ms,
+				   struct vbuf_buffer **buf)
+{
+	int err = 0, reserved;
+	struct timespec ts;
+	struct vbuf_buffer *_buf;
+
+	reserved = vbuf_pool_free_reserve(pool, 1);
+	if (!reserved && (timeout_ms == 0)) {
+		/* No wait, return */
+		return -EAGAIN;
+	} else if (!reserved) {
+		VBUF_MUTEX_LOCK(&pool->mutex);
+
+		/* Check again once registered as a waiter: a buffer returned
+		 * before is found here, a buffer returned after signals the
+		 * condition (see vbuf_pool_depot_put()) */
+#if defined(__GNUC__)
+		__atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+#else
+#	error no atomic functions found on this platform
+#endif
+		reserved = vbuf_pool_free_reserve(pool, 1);
+		if (!reserved) {
+			if (timeout_ms > 0) {
+				/* Wait until timeout */
+				vbuf_get_time_with_ms_delay(&ts, timeout_ms);
+				err = pthread_cond_timedwait(
+					&pool->cond, &pool->mutex, &ts);
+			} else {
+				/* Wait forever */
+				err = pthread_cond_wait(&pool->cond,
+							&pool->mutex);
+			}
+			if (err == 0)
+				reserved = vbuf_pool_free_reserve(pool, 1);
+		}
+#if defined(__GNUC__)
+		__atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+
+		VBUF_MUTEX_UNLOCK(&pool->mutex);
+
+		if (err == ETIMEDOUT) {
+			/* Timeout */
+			return -ETIMEDOUT;
+		} else if (err != 0) {
+			/* Other error */
+			ULOG_ERRNO("pthread_cond_wait", err);
+			return -err;
+		} else if (!reserved) {
+			/* Still no buffer after waiting */
+			return -EAGAIN;
+		}
+	}
+
+	_buf = vbuf_pool_ring_pop(pool);
+
+	/* The buffer is not referenced by anyone else: its reference count
+	 * is set without a read-modify-write operation */
+#if defined(__GNUC__)
+	__atomic_store_n(&_buf->ref_count, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+	vbuf_local_init(_buf);
+
+	*buf = _buf;
+	return 0;
+}
+
+
+/* Get a buffer from the list of free buffers under the pool mutex */
+static int vbuf_pool_get_locked(struct vbuf_pool *pool,
+				int timeout_ms,
+				struct vbuf_buffer **buf)
+{
+	int err = 0, res = 0;
+	struct timespec ts;
+	struct vbuf_buffer *_buf = NULL;
+
+	VBUF_MUTEX_LOCK(&pool->mutex);
+
+	if (pool->free == 0) {
+		if (timeout_ms > 0) {
+			/* Wait until timeout */
+			vbuf_get_time_with_ms_delay(&ts, timeout_ms);
+			err = pthread_cond_timedwait(
+				&pool->cond, &pool->mutex, &ts);
+		} else if (timeout_ms == 0) {
+			/* No wait, return */
+			res = -EAGAIN;
+			goto out;
+		} else {
+			/* Wait forever */
+			err = pthread_cond_wait(&pool->cond, &pool->mutex);
+		}
+		if (err == ETIMEDOUT) {
+			/* Timeout */
+			res = -ETIMEDOUT;
+			goto out;
+		} else if (err != 0) {
+			/* Other error */
+			ULOG_ERRNO("pthread_cond_wait", err);
+			res = -err;
+			goto out;
+		}
+	}
+
+	if (pool->free == 0) {
+		/* Still no buffer after waiting */
+		res = -EAGAIN;
+		goto out;
+	}
+
+	/* A buffer is available */
+	_buf = list_entry(list_first(&pool->buffers), typeof(*_buf), node);
+
+	/* The buffer is not referenced by anyone else: its reference count
+	 * is set without a read-modify-write operation */
+#if defined(__GNUC__)
+	__atomic_store_n(&_buf->ref_count, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
+	vbuf_local_init(_buf);
+
+	/* Remove the buffer from the list */
+	list_del(&_buf->node);
+	pool->free--;
+
+out:
+	VBUF_MUTEX_UNLOCK(&pool->mutex);
+
+	*buf = _buf;
+	return res;
+}
+
+
+/* Return buffers to the depot (list or ring of free buffers) and notify
+ * that buffers are available; with the lock-free free list, the pool
+ * event is only signaled when the depot was empty and the pool mutex is
+ * only locked when a vbuf_pool_get() caller is waiting */
+static void vbuf_pool_depot_put(struct vbuf_pool *pool,
+				struct vbuf_buffer **bufs,
+				unsigned int count)
+{
+	int res;
+	unsigned int i, free = 0, waiters = 0;
+
+	if (!pool->lock_free) {
+		VBUF_MUTEX_LOCK(&pool->mutex);
+
+		/* Add the buffers to the list: at the tail for a FIFO
+		 * policy, at the head otherwise (the last buffer of the
+		 * array, the most recently returned, ends up first) */
+		for (i = 0; i < count; i++) {
+			if (pool->policy == VBUF_POOL_POLICY_FIFO)
+				list_add_after(list_last(&pool->buffers),
+					       &bufs[i]->node);
+			else
+				list_add_after(&pool->buffers, &bufs[i]->node);
+		}
+		pool->free += count;
+
+		/* Notify that a buffer is available */
+		res = pomp_evt_signal(pool->evt);
+		if (res < 0)
+			ULOG_ERRNO("pomp_evt_signal", -res);
+
+		if (pool->free == count) {
+			/* The pool was empty,
+			 * someone might been waiting for a buffer */
+			if (count == 1)
+				VBUF_COND_SIGNAL(&pool->cond);
+			else
+				VBUF_COND_BROADCAST(&pool->cond);
+		}
+
+		VBUF_MUTEX_UNLOCK(&pool->mutex);
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		vbuf_pool_ring_push(pool, bufs[i]);
+
+	/* The buffers are published before being added to the free count;
+	 * both the free count update and the waiters count read are
+	 * sequentially consistent, as the waiters count update and the free
+	 * count read in vbuf_pool_get_lock_free() */
+#if defined(__GNUC__)
+	free = __atomic_fetch_add(&pool->free, count, __ATOMIC_SEQ_CST);
+	waiters = __atomic_load_n(&pool->waiters, __ATOMIC_SEQ_CST);
+#else
+#	error no atomic functions found on this platform
+#endif
+
+	if (free == 0) {
+		/* Notify that a buffer is available */
+		res = pomp_evt_signal(pool->evt);
+		if (res < 0)
+			ULOG_ERRNO("pomp_evt_signal", -res);
+	}
+
+	if (waiters > 0) {
+		/* Someone is waiting for a buffer; the mutex is held
+		 * between the waiter's last check and its wait */
+		VBUF_MUTEX_LOCK(&pool->mutex);
+		if (count == 1)
+			VBUF_COND_SIGNAL(&pool->cond);
+		else
+			VBUF_COND_BROADCAST(&pool->cond);
+		VBUF_MUTEX_UNLOCK(&pool->mutex);
+	}
+}
+
+
+/* Take up to count buffers from the depot without waiting; the buffers
+ * reference counts are not set; returns the number of buffers taken */
+static unsigned int vbuf_pool_depot_take(struct vbuf_pool *pool,
+					 struct vbuf_buffer **bufs,
+					 unsigned int count)
+{
+	unsigned int n = 0;
+
+	if (pool->lock_free) {
+		count = vbuf_pool_free_reserve(pool, count);
+		for (n = 0; n < count; n++)
+			bufs[n] = vbuf_pool_ring_pop(pool);
+		return n;
+	}
+
+	VBUF_MUTEX_LOCK(&pool->mutex);
+	while ((n < count) && (pool->free > 0)) {
+		bufs[n] = list_entry(
+			list_first(&pool->buffers), typeof(*bufs[n]), node);
+		list_del(&bufs[n]->node);
+		pool->free--;
+		n++;
+	}
+	VBUF_MUTEX_UNLOCK(&pool->mutex);
+
+	return n;
+}
+
+
+/* Index of the CPU the calling thread is running on (0 if unknown) */
+static unsigned int vbuf_pool_current_cpu(void)
+{
+#if defined(__linux__)
+	int cpu = sched_getcpu();
+	if (cpu >= 0)
+		return cpu;
+#endif
+	return 0;
+}
+
+
+/* Per-CPU caches: create the magazines */
+static int vbuf_pool_magazines_init(struct vbuf_pool *pool,
+				    unsigned int size)
+{
+	int res;
+	long cpus;
+	unsigned int i, count;
+	void *mem = NULL;
+
+	cpus = sysconf(_SC_NPROCESSORS_CONF);
+	count = (cpus > 1) ? (unsigned int)cpus : 1;
+
+	res = posix_memalign(
+		&mem, VBUF_CACHE_LINE_SIZE, count * sizeof(*pool->magazines));
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign:magazines", res);
+		return -res;
+	}
+	memset(mem, 0, count * sizeof(*pool->magazines));
+	pool->magazines = mem;
+
+	for (i = 0; i < count; i++) {
+		res = pthread_mutex_init(&pool->magazines[i].mutex, NULL);
+		if (res != 0) {
+			ULOG_ERRNO("pthread_mutex_init", res);
+			while (i > 0)
+				pthread_mutex_destroy(
+					&pool->magazines[--i].mutex);
+			free(pool->magazines);
+			pool->magazines = NULL;
+			return -res;
+		}
+	}
+
+	pool->magazine_count = count;
+	pool->magazine_size = size;
+
+	return 0;
+}
+
+
+/* Per-CPU caches: return the cached buffers to the depot and destroy the
+ * magazines */
+static void vbuf_pool_magazines_fini(struct vbuf_pool *pool)
+{
+	unsigned int i;
+	struct vbuf_pool_magazine *mag;
+
+	for (i = 0; i < pool->magazine_count; i++) {
+		mag = &pool->magazines[i];
+		if (mag->count > 0)
+			vbuf_pool_depot_put(pool, mag->bufs, mag->count);
+		mag->count = 0;
+		pthread_mutex_destroy(&mag->mutex);
+	}
+
+	free(pool->magazines);
+	pool->magazines = NULL;
+	pool->magazine_count = 0;
+}
+
+
+/* Per-CPU caches: set the cached buffers count of a magazine */
+static void vbuf_pool_magazine_set_count(struct vbuf_pool_magazine *mag,
+					 unsigned int count)
+{
+	/* The count is read without locking by vbuf_pool_get_count() */
+#if defined(__GNUC__)
+	__atomic_store_n(&mag->count, count, __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
+}
+
+
+/* Per-CPU caches: take the most recently cached buffer of a magazine;
+ * returns NULL if the magazine is empty */
+static struct vbuf_buffer *vbuf_pool_magazine_pop(struct vbuf_pool_magazine *mag)
+{
+	struct vbuf_buffer *buf = NULL;
+
+	VBUF_MUTEX_LOCK(&mag->mutex);
+	if (mag->count > 0) {
+		buf = mag->bufs[mag->count - 1];
+		vbuf_pool_magazine_set_count(mag, mag->count - 1);
+	}
+	VBUF_MUTEX_UNLOCK(&mag->mutex);
+
+	return buf;
+}
+
+
+/* Per-CPU caches: take a buffer from any magazine, so that buffers cached
+ * for other CPUs are not reported as unavailable */
+static struct vbuf_buffer *vbuf_pool_magazines_steal(struct vbuf_pool *pool)
+{
+	unsigned int i;
+	struct vbuf_buffer *buf = NULL;
+
+	for (i = 0; (i < pool->magazine_count) && (buf == NULL); i++)
+		buf = vbuf_pool_magazine_pop(&pool->magazines[i]);
+
+	return buf;
+}
+
+
+/* Per-CPU caches: return all the buffers of a magazine to the depot */
+static void vbuf_pool_magazine_flush(struct vbuf_pool *pool,
+				     struct vbuf_pool_magazine *mag)
+{
+	unsigned int count;
+	struct vbuf_buffer *bufs[2 * VBUF_POOL_MAGAZINE_MAX_SIZE];
+
+	/* The depot is never accessed with a magazine mutex held */
+	VBUF_MUTEX_LOCK(&mag->mutex);
+	count = mag->count;
+	memcpy(bufs, mag->bufs, count * sizeof(*bufs));
+	vbuf_pool_magazine_set_count(mag, 0);
+	VBUF_MUTEX_UNLOCK(&mag->mutex);
+
+	if (count > 0)
+		vbuf_pool_depot_put(pool, bufs, count);
+}
+
+
+/* Per-CPU caches: notify that a buffer is available in a magazine which
+ * was empty; a vbuf_pool_get() caller that did not find any buffer is
+ * notified of the next buffer cached in any magazine */
+static void vbuf_pool_magazine_signal(struct vbuf_pool *pool)
+{
+	int res;
+
+	res = pomp_evt_signal(pool->evt);
+	if (res < 0)
+		ULOG_ERRNO("pomp_evt_signal", -res);
+}
+
+
+/* Per-CPU caches: get a buffer from the current CPU magazine, refilled
+ * from the depot in batches of the magazine size; other magazines are
+ * looked up before waiting for a buffer to be returned */
+static int vbuf_pool_get_cached(struct vbuf_pool *pool,
+				int timeout_ms,
+				struct vbuf_buffer **buf)
+{
+	int res = 0;
+	unsigned int count, cached = 0;
+	struct vbuf_pool_magazine *mag;
+	struct vbuf_buffer *_buf;
+	struct vbuf_buffer *bufs[VBUF_POOL_MAGAZINE_MAX_SIZE];
+
+	mag = &pool->magazines[vbuf_pool_current_cpu() % pool->magazine_count];
+	_buf = vbuf_pool_magazine_pop(mag);
+
+	if (_buf == NULL) {
+		/* Refill the magazine from the depot */
+		count = vbuf_pool_depot_take(pool, bufs, pool->magazine_size);
+		if (count > 0) {
+			/* The first buffer taken from a LIFO depot is the
+			 * most recently returned: it is used, and the next
+			 * ones end up on top of the magazine, which keeps room
+			 * for a buffer to be returned */
+			_buf = bufs[0];
+			VBUF_MUTEX_LOCK(&mag->mutex);
+			cached = mag->count;
+			while ((count > 1) &&
+			       (mag->count < 2 * pool->magazine_size - 1)) {
+				mag->bufs[mag->count] = bufs[--count];
+				vbuf_pool_magazine_set_count(mag,
+							     mag->count + 1);
+			}
+			cached = (cached == 0) && (mag->count > 0);
+			VBUF_MUTEX_UNLOCK(&mag->mutex);
+			/* The magazine was empty */
+			if (cached)
+				vbuf_pool_magazine_signal(pool);
+			/* The magazine was refilled concurrently */
+			if (count > 1)
+				vbuf_pool_depot_put(pool, &bufs[1], count - 1);
+		}
+	}
+
+	if (_buf == NULL)
+		_buf = vbuf_pool_magazines_steal(pool);
+
+	if ((_buf == NULL) && (timeout_ms != 0)) {
+		/* Register as a waiter before looking up the magazines
+		 * again: a buffer cached before is found here, a buffer
+		 * cached after is returned to the depot (see
+		 * vbuf_pool_put_cached(), the magazine mutex orders the
+		 * waiters count update and read) */
+#if defined(__GNUC__)
+		__atomic_add_fetch(&pool->waiters, 1, __ATOMIC_SEQ_CST);
+#else
+#	error no atomic functions found on this platform
+#endif
+		_buf = vbuf_pool_magazines_steal(pool);
+		if (_buf == NULL) {
+			/* Wait for a buffer from the depot; the reference
+			 * count is set */
+			if (pool->lock_free)
+				res = vbuf_pool_get_lock_free(
+					pool, timeout_ms, buf);
+			else
+				res = vbuf_pool_get_locked(
+					pool, timeout_ms, buf);
+		}
+#if defined(__GNUC__)
+		__atomic_sub_fetch(&pool->waiters, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+		if (_buf == NULL)
+			return res;
+	}
+
+	if (_buf == NULL)
+		return -EAGAIN;
+
+	/* The buffer is not referenced by anyone else: its reference count
+	 * is set without a read-modify-write operation */
+#if defined(__GNUC__)
+	__atomic_store_n(&_buf->ref_count, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
+	vbuf_local_init(_buf);
+
+	*buf = _buf;
+	return 0;
+}
+
+
+/* Per-CPU caches: return a buffer to the current CPU magazine; when the
+ * magazine is full, its older half is first returned to the depot; the pool
+ * event is only signaled when the magazine was empty */
+static void vbuf_pool_put_cached(struct vbuf_pool *pool,
+				 struct vbuf_buffer *buf)
+{
+	unsigned int count = 0, cached, waiters;
+	struct vbuf_pool_magazine *mag;
+	struct vbuf_buffer *bufs[VBUF_POOL_MAGAZINE_MAX_SIZE];
+
+	mag = &pool->magazines[vbuf_pool_current_cpu() % pool->magazine_count];
+
+	VBUF_MUTEX_LOCK(&mag->mutex);
+	if (mag->count >= 2 * pool->magazine_size) {
+		/* The most recently cached buffers are kept */
+		count = pool->magazine_size;
+		memcpy(bufs, mag->bufs, count * sizeof(*bufs));
+		memmove(mag->bufs,
+			&mag->bufs[count],
+			(mag->count - count) * sizeof(*bufs));
+		vbuf_pool_magazine_set_count(mag, mag->count - count);
+	}
+	mag->bufs[mag->count] = buf;
+	vbuf_pool_magazine_set_count(mag, mag->count + 1);
+	cached = mag->count;
+	/* A waiter registered before looking up this magazine (see
+	 * vbuf_pool_get_cached()) either finds the buffer or is seen here */
+#if defined(__GNUC__)
+	waiters = __atomic_load_n(&pool->waiters, __ATOMIC_RELAXED);
+#else
+#	error no atomic load function found on this platform
+#endif
+	VBUF_MUTEX_UNLOCK(&mag->mutex);
+
+	if (count > 0)
+		vbuf_pool_depot_put(pool, bufs, count);
+	else if (cached == 1)
+		vbuf_pool_magazine_signal(pool);
+
+	/* Someone is waiting for a buffer: make the cached buffers
+	 * available to all */
+	if (waiters > 0)
+		vbuf_pool_magazine_flush(pool, mag);
+}
+
+
+/* Elastic pools: monotonic time in microseconds */
+static uint64_t vbuf_pool_time_us(void)
+{
+	struct timespec ts;
+	uint64_t us = 0;
+
+	time_get_monotonic(&ts);
+	time_timespec_to_us(&ts, &us);
+	return us;
+}
+
+
+/* Elastic pools: reserve a new buffer in the pool count, up to the
+ * maximum count; returns 1 on success, 0 if the pool is at its maximum */
+static int vbuf_pool_count_inc(struct vbuf_pool *pool)
+{
+	unsigned int count;
+
+#if defined(__GNUC__)
+	count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+	do {
+		if (count >= pool->max_count)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&pool->count,
+					      &count,
+					      count + 1,
+					      1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+#else
+#	error no atomic compare and exchange function found on this platform
+#endif
+
+	return 1;
+}
+
+
+/* Elastic pools: remove a buffer from the pool count, down to the
+ * minimum count; returns 1 on success, 0 if the pool is at its minimum */
+static int vbuf_pool_count_dec(struct vbuf_pool *pool)
+{
+	unsigned int count;
+
+#if defined(__GNUC__)
+	count = __atomic_load_n(&pool->count, __ATOMIC_RELAXED);
+	do {
+		if (count <= pool->min_count)
+			return 0;
+	} while (!__atomic_compare_exchange_n(&pool->count,
+					      &count,
+					      count - 1,
+					      1,
+					      __ATOMIC_RELAXED,
+					      __ATOMIC_RELAXED));
+#else
+#	error no atomic compare and exchange function found on this platform
+#endif
+
+	return 1;
+}
+
+
+/* Create a buffer of the pool, referenced once */
+static int vbuf_pool_buffer_new(struct vbuf_pool *pool,
+				struct vbuf_buffer **ret_obj)
+{
+	int res;
+	struct vbuf_buffer *buf = NULL;
+
+	res = vbuf_create(pool->config.capacity,
+			  pool->config.userdata_capacity,
+			  pool->config.metadata_capacity,
+			  &pool->cbs,
+			  pool,
+			  VBUF_CREATE_STATIC_CBS,
+			  &buf);
+	if (res < 0)
+		return res;
+
+	buf->deferred_release = pool->deferred_release ? 1 : 0;
+	if (pool->parent != NULL) {
+		/* The buffer is seen as originating from the parent pool */
+		buf->pool = pool->parent;
+		buf->pool_class = pool->class_index;
+	}
+	if (pool->config.plane_count > 0) {
+		res = vbuf_set_planes(
+			buf, pool->config.planes, pool->config.plane_count);
+		if (res < 0) {
+			vbuf_destroy(buf);
+			return res;
+		}
+	}
+
+	*ret_obj = buf;
+	return 0;
+}
+
+
+/* Elastic pools: allocate a new buffer instead of waiting for one to be
+ * returned; returns -EAGAIN if the pool is at its maximum count */
+static int vbuf_pool_grow(struct vbuf_pool *pool, struct vbuf_buffer **buf)
+{
+	int res;
+
+	if (!vbuf_pool_count_inc(pool))
+		return -EAGAIN;
+
+	res = vbuf_pool_buffer_new(pool, buf);
+	if (res < 0) {
+#if defined(__GNUC__)
+		__atomic_sub_fetch(&pool->count, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+		return res;
+	}
+
+	return 0;
+}
+
+
+/* Elastic pools: whether a free buffer has been idle long enough to be
+ * released */
+static int vbuf_pool_buffer_idle(struct vbuf_pool *pool,
+				 struct vbuf_buffer *buf,
+				 uint64_t now)
+{
+	uint64_t idle_since;
+
+#if defined(__GNUC__)
+	idle_since = __atomic_load_n(&buf->pool_idle_since, __ATOMIC_RELAXED);
+#else
+#	error no atomic load function found on this platform
+#endif
+
+	return now - idle_since >= (uint64_t)pool->idle_timeout_ms * 1000;
+}
+
+
+/* Elastic pools: whether a free buffer has been idle long enough to be
+ * released (and can be, the pool count is then decremented) */
+static int vbuf_pool_buffer_expired(struct vbuf_pool *pool,
+				    struct vbuf_buffer *buf,
+				    uint64_t now)
+{
+	if (!vbuf_pool_buffer_idle(pool, buf, now))
+		return 0;
+
+	return vbuf_pool_count_dec(pool);
+}
+
+
+/* Size classes: increment a statistics counter */
+static void vbuf_pool_stat_inc(uint64_t *counter)
+{
+#if defined(__GNUC__)
+	__atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+#else
+#	error no atomic functions found on this platform
+#endif
+}
+
+
 int vbuf_pool_new(unsigned int count,
 		  size_t capacity,
 		  size_t userdata_capacity,
 		  const struct vbuf_cbs *cbs,
 		  struct vbuf_pool **ret_obj)
+{
+	struct vbuf_pool_config config = {
+		.count = count,
+		.capacity = capacity,
+		.userdata_capacity = userdata_capacity,
+	};
+
+	return vbuf_pool_new_ext(&config, cbs, ret_obj);
+}
+
+
+/* Create a pool (without size classes); the pools of the size classes of
+ * a parent pool use the parent pool event */
+static int vbuf_pool_create(const struct vbuf_pool_config *config,
+			    const struct vbuf_cbs *cbs,
+			    struct vbuf_pool *parent,
+			    unsigned int class_index,
+			    struct vbuf_pool **ret_obj)
 {
 	int res = 0, mutex_init = 0, cond_init = 0;
-	unsigned int i;
-	struct vbuf_buffer *buf = NULL, *tmp_buf;
+	unsigned int i, magazine_size;
+	struct vbuf_buffer *buf = NULL;
 	struct vbuf_pool *pool;
+	void *mem = NULL;
 
-	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
-	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		(config->max_count != 0) && (config->max_count < config->count),
+		EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->magazine_size > VBUF_POOL_MAGAZINE_MAX_SIZE, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(config->policy > VBUF_POOL_POLICY_CPU_AFFINE,
+				 EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(
+		config->lock_free && (config->policy == VBUF_POOL_POLICY_LIFO),
+		EINVAL);
 
-	pool = calloc(1, sizeof(*pool));
-	if (pool == NULL) {
-		res = -ENOMEM;
-		ULOG_ERRNO("calloc:pool", -res);
+	/* The pool object has cache line aligned members */
+	res = posix_memalign(&mem, VBUF_CACHE_LINE_SIZE, sizeof(*pool));
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign:pool", res);
 		*ret_obj = NULL;
-		return res;
+		return -res;
 	}
+	memset(mem, 0, sizeof(*pool));
+	pool = mem;
 
-	pool->count = count;
+	/* Callback functions table shared by all buffers of the pool */
+	pool->cbs = *cbs;
+	pool->deferred_release = config->deferred_release;
+	pool->lock_free = config->lock_free ? 1 : 0;
+	pool->policy = config->policy;
+	pool->config = *config;
+	pool->count = config->count;
+	pool->min_count = config->count;
+	pool->max_count =
+		(config->max_count != 0) ? config->max_count : config->count;
+	pool->idle_timeout_ms = config->idle_timeout_ms;
+	pool->parent = parent;
+	pool->class_index = class_index;
 	list_init(&pool->buffers);
 
+	if (parent != NULL) {
+		/* The class pool is registered before its buffers are
+		 * created, as they are returned through the parent pool */
+		parent->classes[class_index] = pool;
+		parent->class_count = class_index + 1;
+	}
+
+	if (pool->lock_free) {
+		res = vbuf_pool_ring_init(pool);
+		if (res < 0)
+			goto error;
+	}
+
 	res = pthread_mutex_init(&pool->mutex, NULL);
 	if (res != 0) {
 		res = -res;
@@ -69,38 +1023,125 @@ int vbuf_pool_new(unsigned int count,
 	}
 	cond_init = 1;
 
-	pool->evt = pomp_evt_new();
+	pool->evt = (parent != NULL) ? parent->evt : pomp_evt_new();
 	if (pool->evt == NULL) {
 		res = -ENOMEM;
 		ULOG_ERRNO("pomp_evt_new", -res);
 		goto error;
 	}
 
+	magazine_size = config->magazine_size;
+	if ((magazine_size == 0) &&
+	    (pool->policy == VBUF_POOL_POLICY_CPU_AFFINE))
+		magazine_size = VBUF_POOL_MAGAZINE_DEFAULT_SIZE;
+	if (magazine_size > 0) {
+		res = vbuf_pool_magazines_init(pool, magazine_size);
+		if (res < 0)
+			goto error;
+	}
+
 	/* Allocate all buffers */
 	for (i = 0; i < pool->count; i++) {
-		res = vbuf_new(capacity, userdata_capacity, cbs, pool, &buf);
+		res = vbuf_pool_buffer_new(pool, &buf);
 		if (res < 0)
 			goto error;
 
-		vbuf_unref(buf);
+		/* The buffer is put into the pool directly, not through the
+		 * reclaimer thread for deferred release pools */
+#if defined(__GNUC__)
+		__atomic_store_n(&buf->ref_count, 0, __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
+		vbuf_release(buf);
 		buf = NULL;
 	}
 
+	/* Idle buffers above the minimum count are released periodically
+	 * by the reclaimer thread */
+	if ((pool->max_count > pool->min_count) && (pool->idle_timeout_ms > 0))
+		vbuf_reclaim_add_pool(pool);
+
 	*ret_obj = pool;
 	return 0;
 
 error:
-	buf = NULL;
-	tmp_buf = NULL;
-	list_walk_entry_forward_safe(&pool->buffers, buf, tmp_buf, node)
-	{
-		vbuf_destroy(buf);
-	}
+	if (pool->magazines != NULL)
+		vbuf_pool_magazines_fini(pool);
+	vbuf_pool_destroy_buffers(pool);
+	free(pool->ring);
 
 	if (mutex_init)
 		pthread_mutex_destroy(&pool->mutex);
 	if (cond_init)
 		pthread_cond_destroy(&pool->cond);
+	if ((pool->evt != NULL) && (parent == NULL))
+		pomp_evt_destroy(pool->evt);
+	if (parent != NULL)
+		parent->class_count = class_index;
+	free(pool);
+	*ret_obj = NULL;
+	return res;
+}
+
+
+/* Size classes: create a parent pool and the pools of its classes */
+static int vbuf_pool_classes_new(const struct vbuf_pool_config *config,
+				 const struct vbuf_cbs *cbs,
+				 struct vbuf_pool **ret_obj)
+{
+	int res = 0;
+	unsigned int i;
+	struct vbuf_pool *pool;
+	struct vbuf_pool_config class_config;
+	void *mem = NULL;
+
+	ULOG_ERRNO_RETURN_ERR_IF(config->class_count > VBUF_POOL_MAX_CLASSES,
+				 EINVAL);
+	for (i = 1; i < config->class_count; i++) {
+		/* The classes are sorted by increasing capacity */
+		ULOG_ERRNO_RETURN_ERR_IF(config->classes[i].capacity <=
+						 config->classes[i - 1].capacity,
+					 EINVAL);
+	}
+
+	res = posix_memalign(&mem, VBUF_CACHE_LINE_SIZE, sizeof(*pool));
+	if (res != 0) {
+		ULOG_ERRNO("posix_memalign:pool", res);
+		*ret_obj = NULL;
+		return -res;
+	}
+	memset(mem, 0, sizeof(*pool));
+	pool = mem;
+
+	pool->cbs = *cbs;
+	pool->config = *config;
+	pool->evt = pomp_evt_new();
+	if (pool->evt == NULL) {
+		res = -ENOMEM;
+		ULOG_ERRNO("pomp_evt_new", -res);
+		goto error;
+	}
+
+	/* One pool per class, with the class capacity and counts */
+	class_config = *config;
+	class_config.class_count = 0;
+	for (i = 0; i < config->class_count; i++) {
+		class_config.capacity = config->classes[i].capacity;
+		class_config.count = config->classes[i].count;
+		class_config.max_count = config->classes[i].max_count;
+		res = vbuf_pool_create(
+			&class_config, cbs, pool, i, &pool->classes[i]);
+		if (res < 0)
+			goto error;
+	}
+
+	*ret_obj = pool;
+	return 0;
+
+error:
+	for (i = 0; i < pool->class_count; i++)
+		vbuf_pool_destroy(pool->classes[i]);
 	if (pool->evt != NULL)
 		pomp_evt_destroy(pool->evt);
 	free(pool);
@@ -109,13 +1150,59 @@ error:
 }
 
 
+/* Size classes: get the pool of a class (a pool without size classes is
+ * its own single class); returns NULL if the index is out of range */
+static struct vbuf_pool *vbuf_pool_get_class(struct vbuf_pool *pool,
+					     unsigned int index)
+{
+	if (pool->class_count == 0)
+		return (index == 0) ? pool : NULL;
+
+	return (index < pool->class_count) ? pool->classes[index] : NULL;
+}
+
+
+int vbuf_pool_new_ext(const struct vbuf_pool_config *config,
+		      const struct vbuf_cbs *cbs,
+		      struct vbuf_pool **ret_obj)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(config == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(cbs == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(ret_obj == NULL, EINVAL);
+
+	if (config->class_count > 0)
+		return vbuf_pool_classes_new(config, cbs, ret_obj);
+
+	return vbuf_pool_create(config, cbs, NULL, 0, ret_obj);
+}
+
+
 int vbuf_pool_destroy(struct vbuf_pool *pool)
 {
-	struct vbuf_buffer *buf = NULL, *tmp_buf = NULL;
+	unsigned int i;
 
 	if (pool == NULL)
 		return 0;
 
+	if (pool->class_count > 0) {
+		for (i = 0; i < pool->class_count; i++)
+			vbuf_pool_destroy(pool->classes[i]);
+		pomp_evt_destroy(pool->evt);
+		free(pool);
+		return 0;
+	}
+
+	if ((pool->max_count > pool->min_count) && (pool->idle_timeout_ms > 0))
+		vbuf_reclaim_remove_pool(pool);
+
+	/* Wait for the buffers being returned by the reclaimer thread */
+	if (pool->deferred_release)
+		vbuf_reclaim_flush();
+
+	/* Return the cached buffers to the depot */
+	if (pool->magazines != NULL)
+		vbuf_pool_magazines_fini(pool);
+
 	VBUF_MUTEX_LOCK(&pool->mutex);
 
 	if (pool->free != pool->count) {
@@ -125,18 +1212,15 @@ int vbuf_pool_destroy(struct vbuf_pool *pool)
 	}
 
 	/* Free all buffers */
-	list_walk_entry_forward_safe(&pool->buffers, buf, tmp_buf, node)
-	{
-		list_del(&buf->node);
-		pool->free--;
-		vbuf_destroy(buf);
-	}
+	vbuf_pool_destroy_buffers(pool);
 
 	VBUF_MUTEX_UNLOCK(&pool->mutex);
 
+	free(pool->ring);
 	pthread_mutex_destroy(&pool->mutex);
 	pthread_cond_destroy(&pool->cond);
-	pomp_evt_destroy(pool->evt);
+	if (pool->parent == NULL)
+		pomp_evt_destroy(pool->evt);
 	free(pool);
 
 	return 0;
@@ -146,141 +1230,381 @@ int vbuf_pool_destroy(struct vbuf_pool *pool)
 int vbuf_pool_get_count(struct vbuf_pool *pool)
 {
 	int count;
+	unsigned int i;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+
+	if (pool->class_count > 0) {
+		for (i = 0, count = 0; i < pool->class_count; i++)
+			count += vbuf_pool_get_count(pool->classes[i]);
+		return count;
+	}
+
+	if (pool->lock_free) {
+#if defined(__GNUC__)
+		count = __atomic_load_n(&pool->free, __ATOMIC_RELAXED);
+#else
+#	error no atomic load function found on this platform
+#endif
+	} else {
+		VBUF_MUTEX_LOCK(&pool->mutex);
+		count = pool->free;
+		VBUF_MUTEX_UNLOCK(&pool->mutex);
+	}
+
+	/* Buffers cached in the per-CPU magazines are available too */
+	for (i = 0; i < pool->magazine_count; i++) {
+#if defined(__GNUC__)
+		count += __atomic_load_n(&pool->magazines[i].count,
+					 __ATOMIC_RELAXED);
+#else
+#	error no atomic load function found on this platform
+#endif
+	}
+
+	return count;
+}
+
+
+int vbuf_pool_trim(struct vbuf_pool *pool)
+{
+	int count = 0;
+	unsigned int i, j, k, n;
+	uint64_t now;
+	struct list_node expired;
+	struct vbuf_pool_magazine *mag;
+	struct vbuf_buffer *buf = NULL, *tmp_buf = NULL;
+	struct vbuf_buffer *bufs[2 * VBUF_POOL_MAGAZINE_MAX_SIZE];
 
 	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
 
+	if (pool->class_count > 0) {
+		for (i = 0; i < pool->class_count; i++)
+			count += vbuf_pool_trim(pool->classes[i]);
+		return count;
+	}
+
+	if (pool->max_count == pool->min_count)
+		return 0;
+
+	now = vbuf_pool_time_us();
+
+	/* Per-CPU caches; the buffers are destroyed without holding the
+	 * magazine mutex */
+	for (i = 0; i < pool->magazine_count; i++) {
+		mag = &pool->magazines[i];
+		VBUF_MUTEX_LOCK(&mag->mutex);
+		for (j = 0, k = 0, n = 0; j < mag->count; j++) {
+			if (vbuf_pool_buffer_expired(pool, mag->bufs[j], now))
+				bufs[n++] = mag->bufs[j];
+			else
+				mag->bufs[k++] = mag->bufs[j];
+		}
+		vbuf_pool_magazine_set_count(mag, k);
+		VBUF_MUTEX_UNLOCK(&mag->mutex);
+
+		for (j = 0; j < n; j++)
+			vbuf_destroy(bufs[j]);
+		count += n;
+	}
+
+	if (pool->lock_free) {
+		/* The ring is FIFO, the least recently returned buffers come
+		 * first: stop at the first buffer that is not expired; the
+		 * buffers at the head are only read while no other thread
+		 * trims the pool (they are not destroyed meanwhile) */
+#if defined(__GNUC__)
+		if (__atomic_exchange_n(&pool->trimming, 1, __ATOMIC_ACQUIRE))
+			return count;
+		while (((buf = vbuf_pool_ring_peek(pool)) != NULL) &&
+		       vbuf_pool_buffer_idle(pool, buf, now) &&
+		       vbuf_pool_count_dec(pool)) {
+			/* The buffer may have been taken by a concurrent
+			 * vbuf_pool_get() in between, the next one is then
+			 * released instead */
+			if (vbuf_pool_depot_take(pool, &buf, 1) != 1) {
+				__atomic_add_fetch(
+					&pool->count, 1, __ATOMIC_RELAXED);
+				break;
+			}
+			vbuf_destroy(buf);
+			count++;
+		}
+		__atomic_store_n(&pool->trimming, 0, __ATOMIC_RELEASE);
+#else
+#	error no atomic functions found on this platform
+#endif
+		return count;
+	}
+
+	/* The buffers are destroyed without holding the pool mutex */
+	list_init(&expired);
 	VBUF_MUTEX_LOCK(&pool->mutex);
-	count = pool->free;
+	list_walk_entry_forward_safe(&pool->buffers, buf, tmp_buf, node)
+	{
+		if (!vbuf_pool_buffer_expired(pool, buf, now))
+			continue;
+		list_del(&buf->node);
+		pool->free--;
+		list_add_after(&expired, &buf->node);
+	}
 	VBUF_MUTEX_UNLOCK(&pool->mutex);
 
+	list_walk_entry_forward_safe(&expired, buf, tmp_buf, node)
+	{
+		list_del(&buf->node);
+		vbuf_destroy(buf);
+		count++;
+	}
+
 	return count;
 }
 
 
+/* Get a free buffer of the pool */
+static int vbuf_pool_get_free(struct vbuf_pool *pool,
+			      int timeout_ms,
+			      struct vbuf_buffer **buf)
+{
+	if (pool->magazines != NULL)
+		return vbuf_pool_get_cached(pool, timeout_ms, buf);
+	else if (pool->lock_free)
+		return vbuf_pool_get_lock_free(pool, timeout_ms, buf);
+	else
+		return vbuf_pool_get_locked(pool, timeout_ms, buf);
+}
+
+
 int vbuf_pool_get(struct vbuf_pool *pool,
 		  int timeout_ms,
 		  struct vbuf_buffer **buf)
 {
-	int err = 0, res = 0;
-	struct timespec ts;
+	int res = 0;
 	struct vbuf_buffer *_buf = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 
-	VBUF_MUTEX_LOCK(&pool->mutex);
+	/* Pool with size classes: get a buffer of the smallest class */
+	if (pool->class_count > 0)
+		return vbuf_pool_get_sized(pool, 0, timeout_ms, buf);
 
-	if (pool->free == 0) {
-		if (timeout_ms > 0) {
-			/* Wait until timeout */
-			vbuf_get_time_with_ms_delay(&ts, timeout_ms);
-			err = pthread_cond_timedwait(
-				&pool->cond, &pool->mutex, &ts);
-		} else if (timeout_ms == 0) {
-			/* No wait, return */
-			res = -EAGAIN;
-			goto out;
-		} else {
-			/* Wait forever */
-			err = pthread_cond_wait(&pool->cond, &pool->mutex);
-		}
-		if (err == ETIMEDOUT) {
-			/* Timeout */
-			res = -ETIMEDOUT;
-			goto out;
-		} else if (err != 0) {
-			/* Other error */
-			ULOG_ERRNO("pthread_cond_wait", err);
-			res = -err;
-			goto out;
-		}
+	if (pool->max_count > pool->min_count) {
+		/* Elastic pool: allocate a new buffer (up to the maximum
+		 * count) rather than waiting */
+		res = vbuf_pool_get_free(pool, 0, &_buf);
+		if (res == -EAGAIN)
+			res = vbuf_pool_grow(pool, &_buf);
+		if ((res == -EAGAIN) && (timeout_ms != 0))
+			res = vbuf_pool_get_free(pool, timeout_ms, &_buf);
+	} else {
+		res = vbuf_pool_get_free(pool, timeout_ms, &_buf);
 	}
-
-	if (pool->free == 0) {
-		/* Still no buffer after waiting */
-		res = -EAGAIN;
-		goto out;
+	if (res < 0) {
+		*buf = NULL;
+		return res;
 	}
 
-	/* A buffer is available */
-	_buf = list_entry(list_first(&pool->buffers), typeof(*_buf), node);
-
-	vbuf_ref(_buf);
-
-	/* Remove the buffer from the list */
-	list_del(&_buf->node);
-	pool->free--;
-
 	/* Call the callback function if implemented */
-	if (_buf->cbs.pool_get) {
-		VBUF_MUTEX_UNLOCK(&pool->mutex);
-
-		res = (*_buf->cbs.pool_get)(
-			_buf, timeout_ms, _buf->cbs.pool_get_userdata);
+	if (_buf->cbs->pool_get) {
+		res = (*_buf->cbs->pool_get)(
+			_buf, timeout_ms, _buf->cbs->pool_get_userdata);
 		if (res < 0) {
 			vbuf_unref(_buf);
 			return res;
 		}
+	}
 
-		goto out2;
+	*buf = _buf;
+
+	return res;
+}
+
+
+int vbuf_pool_get_sized(struct vbuf_pool *pool,
+			size_t min_capacity,
+			int timeout_ms,
+			struct vbuf_buffer **buf)
+{
+	int res = -ENOBUFS;
+	unsigned int i, first;
+	struct vbuf_pool *fit;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	/* Smallest class large enough */
+	for (first = 0; (fit = vbuf_pool_get_class(pool, first)) != NULL;
+	     first++) {
+		if (fit->config.capacity >= min_capacity)
+			break;
+	}
+	if (fit == NULL) {
+		*buf = NULL;
+		return -ENOBUFS;
 	}
+	if (pool->config.class_stats)
+		vbuf_pool_stat_inc(&fit->stat_requests);
 
-out:
-	VBUF_MUTEX_UNLOCK(&pool->mutex);
+	if (pool->class_count == 0) {
+		res = vbuf_pool_get(pool, timeout_ms, buf);
+		if ((res < 0) && pool->config.class_stats)
+			vbuf_pool_stat_inc(&fit->stat_failures);
+		return res;
+	}
 
-out2:
-	*buf = _buf;
+	/* Try the smallest class first, then the larger classes, without
+	 * waiting (elastic classes grow before falling back) */
+	for (i = first; i < pool->class_count; i++) {
+		res = vbuf_pool_get(pool->classes[i], 0, buf);
+		if (res != -EAGAIN)
+			break;
+	}
+
+	/* Wait for a buffer of the smallest class */
+	if ((res == -EAGAIN) && (timeout_ms != 0)) {
+		i = first;
+		res = vbuf_pool_get(fit, timeout_ms, buf);
+	}
+
+	if (pool->config.class_stats) {
+		if (res < 0)
+			vbuf_pool_stat_inc(&fit->stat_failures);
+		else if (i > first)
+			vbuf_pool_stat_inc(&fit->stat_fallbacks);
+	}
 
 	return res;
 }
 
 
+int vbuf_pool_classes_layout(size_t min_capacity,
+			     size_t max_capacity,
+			     unsigned int count,
+			     struct vbuf_pool_class *classes)
+{
+	unsigned int n = 0;
+	size_t capacity = min_capacity;
+
+	ULOG_ERRNO_RETURN_ERR_IF(min_capacity == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(max_capacity < min_capacity, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(count == 0, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(classes == NULL, EINVAL);
+
+	while (1) {
+		ULOG_ERRNO_RETURN_ERR_IF(n >= VBUF_POOL_MAX_CLASSES, EINVAL);
+		classes[n].capacity = capacity;
+		classes[n].count = count;
+		classes[n].max_count = 0;
+		n++;
+		if (capacity == max_capacity)
+			break;
+		/* Double the capacity, up to the largest class */
+		capacity = (capacity > max_capacity / 2) ? max_capacity
+							 : capacity * 2;
+	}
+
+	return n;
+}
+
+
+int vbuf_pool_get_class_count(struct vbuf_pool *pool)
+{
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+
+	return (pool->class_count > 0) ? (int)pool->class_count : 1;
+}
+
+
+int vbuf_pool_get_class_stats(struct vbuf_pool *pool,
+			      unsigned int index,
+			      struct vbuf_pool_class_stats *stats)
+{
+	struct vbuf_pool *class_pool;
+
+	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(stats == NULL, EINVAL);
+
+	class_pool = vbuf_pool_get_class(pool, index);
+	ULOG_ERRNO_RETURN_ERR_IF(class_pool == NULL, EINVAL);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->capacity = class_pool->config.capacity;
+	stats->free = vbuf_pool_get_count(class_pool);
+#if defined(__GNUC__)
+	stats->count = __atomic_load_n(&class_pool->count, __ATOMIC_RELAXED);
+	stats->requests = __atomic_load_n(&class_pool->stat_requests,
+					  __ATOMIC_RELAXED);
+	stats->fallbacks = __atomic_load_n(&class_pool->stat_fallbacks,
+					   __ATOMIC_RELAXED);
+	stats->failures = __atomic_load_n(&class_pool->stat_failures,
+					  __ATOMIC_RELAXED);
+#else
+#	error no atomic load function found on this platform
+#endif
+
+	return 0;
+}
+
+
 int vbuf_pool_put(struct vbuf_pool *pool, struct vbuf_buffer *buf)
 {
 	int res = 0;
-	struct vbuf_meta *meta = NULL, *tmp_meta = NULL;
 
 	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
 	ULOG_ERRNO_RETURN_ERR_IF(buf->pool == NULL, EINVAL);
 
+	/* Pool with size classes: return the buffer to the pool of its
+	 * class */
+	if (pool->class_count > 0) {
+		ULOG_ERRNO_RETURN_ERR_IF(buf->pool_class >= pool->class_count,
+					 EINVAL);
+		pool = pool->classes[buf->pool_class];
+	}
+
 	if (vbuf_get_ref_count(buf) > 0)
 		ULOGW("ref count is not null! (%d)", buf->ref_count);
 
 	/* Call the callback function if implemented */
-	if (buf->cbs.pool_put) {
-		res = (*buf->cbs.pool_put)(buf, buf->cbs.pool_put_userdata);
+	if (buf->cbs->pool_put) {
+		res = (*buf->cbs->pool_put)(buf, buf->cbs->pool_put_userdata);
 		if (res < 0)
 			return res;
 	}
 
-	/* Remove all metadata */
-	list_walk_entry_forward_safe(&buf->metas, meta, tmp_meta, node)
-	{
-		list_del(&meta->node);
-		res = vbuf_meta_destroy(meta);
-		if (res < 0)
-			ULOG_ERRNO("vbuf_meta_destroy", -res);
-	}
+	/* Release all payload segments */
+	vbuf_segments_clear(buf);
 
-	VBUF_MUTEX_LOCK(&pool->mutex);
+	/* Remove all metadata and reset the metadata arena */
+	vbuf_meta_clear(buf);
 
-	/* Add the buffer to the list */
-	list_add_after(list_last(&pool->buffers), &buf->node);
-	pool->free++;
+	/* The buffer contents can no longer be relied upon by
+	 * vbuf_copy_dirty() */
+	buf->dirty_synced_gen = 0;
 
-	/* Notify that a buffer is available */
-	res = pomp_evt_signal(pool->evt);
-	if (res < 0)
-		ULOG_ERRNO("pomp_evt_signal", -res);
+	/* Restore the pool planes descriptors, which may have been replaced
+	 * (for example by vbuf_copy()) */
+	memcpy(buf->planes,
+	       pool->config.planes,
+	       pool->config.plane_count * sizeof(*buf->planes));
+	buf->plane_count = pool->config.plane_count;
 
-	if (pool->free == 1) {
-		/* The pool was empty,
-		 * someone might been waiting for a buffer */
-		VBUF_COND_SIGNAL(&pool->cond);
-	}
+	/* Start of the idle time of the buffer (read by vbuf_pool_trim()
+	 * while the buffer may be in the lock-free free list) */
+#if defined(__GNUC__)
+	if (pool->idle_timeout_ms > 0)
+		__atomic_store_n(&buf->pool_idle_since,
+				 vbuf_pool_time_us(),
+				 __ATOMIC_RELAXED);
+#else
+#	error no atomic store function found on this platform
+#endif
 
-	VBUF_MUTEX_UNLOCK(&pool->mutex);
+	if (pool->magazines != NULL)
+		vbuf_pool_put_cached(pool, buf);
+	else
+		vbuf_pool_depot_put(pool, &buf, 1);
 
 	return 0;
 }
@@ -288,8 +1612,16 @@ int vbuf_pool_put(struct vbuf_pool *pool, struct vbuf_buffer *buf)
 
 int vbuf_pool_abort(struct vbuf_pool *pool)
 {
+	unsigned int i;
+
 	ULOG_ERRNO_RETURN_ERR_IF(pool == NULL, EINVAL);
 
+	if (pool->class_count > 0) {
+		for (i = 0; i < pool->class_count; i++)
+			vbuf_pool_abort(pool->classes[i]);
+		return 0;
+	}
+
 	VBUF_COND_BROADCAST(&pool->cond);
 
 	return 0;
@@ -81,22 +81,188 @@
 	} while (0)
 
 
+/* Internal buffer creation flags */
+/* Allocate the buffer object, user data and payload in a single block */
+#define VBUF_CREATE_SINGLE_ALLOC (1 << 0)
+/* The callback functions table outlives the buffer and is not copied */
+#define VBUF_CREATE_STATIC_CBS (1 << 1)
+/* Allocate the payload in the buffer object memory block too (the
+ * implementation supports it, see VBUF_NEW_INLINE_PAYLOAD) */
+#define VBUF_CREATE_INLINE_PAYLOAD (1 << 2)
+
+
+/* Clone buffers type identifier */
+#define VBUF_TYPE_CLONE 0x56434c4e /* "VCLN" */
+
+
+/* Copy size above which the payload is copied with non-temporal stores
+ * (bypassing the caches) when available */
+#define VBUF_COPY_NT_THRESHOLD (512 * 1024)
+
+
+/* Copy size above which 2D copies are split across workers */
+#define VBUF_COPY_MT_THRESHOLD (1024 * 1024)
+
+
+/* Minimum chunk size of asynchronous copies split across workers */
+#define VBUF_COPY_ASYNC_MIN_CHUNK (256 * 1024)
+
+
+/* Maximum number of internal worker threads */
+#define VBUF_WORKER_MAX_COUNT 4
+
+
+/* Maximum pool per-CPU cache batch size */
+#define VBUF_POOL_MAGAZINE_MAX_SIZE 32
+
+
+/* Default pool per-CPU cache batch size for the CPU affine policy */
+#define VBUF_POOL_MAGAZINE_DEFAULT_SIZE 4
+
+
+/* Metadata entries alignment in the metadata arena */
+#define VBUF_META_ALIGN 16
+
+
+/* Metadata index initial size (must be a power of 2) */
+#define VBUF_META_INDEX_MIN_SIZE 8
+
+
+/* Lock-free metadata read attempts before falling back to locking */
+#define VBUF_META_READ_RETRIES 4
+
+
+/* Internal worker thread work item */
+struct vbuf_work {
+	/* Work function, called from a worker thread */
+	void (*fn)(struct vbuf_work *work);
+	struct list_node node;
+};
+
+
+/* Payload segment: range of a buffer payload memory */
+struct vbuf_segment {
+	/* Referenced buffer owning the payload memory */
+	struct vbuf_buffer *owner;
+	const uint8_t *ptr;
+	size_t len;
+	struct list_node node;
+};
+
+
+/* Metadata data block, shared between buffers (see vbuf_metadata_copy());
+ * its data is read-only while it is shared */
+struct vbuf_meta_blob {
+	/* References count, including the retired metadata entries which
+	 * keep the data valid for lock-free readers */
+	unsigned int ref_count;
+	/* Metadata entries count currently using the data */
+	unsigned int user_count;
+	uint8_t *data;
+};
+
+
 struct vbuf_meta {
 	void *key;
 	unsigned int level;
 	uint8_t *data;
 	size_t len;
+	/* Data block (optional, NULL when the data follows the entry) */
+	struct vbuf_meta_blob *blob;
+	/* Size allocated in the buffer metadata arena (0 if allocated on
+	 * the heap) */
+	size_t arena_size;
 	struct list_node node;
 };
 
 
+/* Metadata index: open addressing hash table of the metadata entries,
+ * indexed by key with linear probing */
+struct vbuf_meta_index {
+	/* Next retired index */
+	struct vbuf_meta_index *retired;
+	/* Slots count (power of 2) */
+	unsigned int size;
+	struct vbuf_meta *slots[];
+};
+
+
+/* Lock-free pool free list slot */
+struct vbuf_pool_slot {
+	/* Slot sequence number: equal to the enqueue position when the slot
+	 * is empty, and to the enqueue position + 1 when it is full */
+	unsigned long seq;
+	struct vbuf_buffer *buf;
+};
+
+
+/* Per-CPU cache of free pool buffers */
+struct vbuf_pool_magazine {
+	pthread_mutex_t mutex;
+	/* Cached buffers count (up to twice the pool magazine size) */
+	unsigned int count;
+	/* Cached buffers, the most recently returned last */
+	struct vbuf_buffer *bufs[2 * VBUF_POOL_MAGAZINE_MAX_SIZE];
+} VBUF_CACHE_ALIGNED;
+
+
 struct vbuf_pool {
+	struct vbuf_cbs cbs;
+	int deferred_release;
+	int lock_free;
+	enum vbuf_pool_policy policy;
 	unsigned int count;
 	unsigned int free;
 	struct list_node buffers;
 	pthread_mutex_t mutex;
 	pthread_cond_t cond;
 	struct pomp_evt *evt;
+
+	/* Lock-free free list: bounded MPMC ring of free buffers (slots count
+	 * is a power of 2, at least the buffer count so that returning a
+	 * buffer never fails); the enqueue and dequeue positions are on
+	 * separate cache lines */
+	struct vbuf_pool_slot *ring;
+	unsigned long ring_mask;
+	unsigned long ring_head VBUF_CACHE_ALIGNED;
+	unsigned long ring_tail VBUF_CACHE_ALIGNED;
+
+	/* Number of vbuf_pool_get() callers waiting on the condition */
+	unsigned int waiters VBUF_CACHE_ALIGNED;
+
+	/* Per-CPU caches (optional, NULL if disabled): buffers are
+	 * exchanged with the depot (list or ring of free buffers) in
+	 * batches of magazine_size buffers */
+	struct vbuf_pool_magazine *magazines;
+	unsigned int magazine_count;
+	unsigned int magazine_size;
+
+	/* Elastic pools: the buffer count (count member, atomically updated)
+	 * varies from min_count to max_count; free buffers above min_count
+	 * idle for idle_timeout_ms are released by the reclaimer thread
+	 * (linked through trim_node) or vbuf_pool_trim(); the lock-free free
+	 * list is only trimmed by one thread at a time (trimming flag) */
+	struct vbuf_pool_config config;
+	unsigned int min_count;
+	unsigned int max_count;
+	unsigned int idle_timeout_ms;
+	struct list_node trim_node;
+	int trimming;
+
+	/* Size classes: a pool with size classes (class_count not null) only
+	 * dispatches to the pools of its classes, which share its event; the
+	 * buffers of the classes pools reference the parent pool and their
+	 * class index (see vbuf_pool_put()) */
+	struct vbuf_pool *parent;
+	unsigned int class_index;
+	unsigned int class_count;
+	struct vbuf_pool *classes[VBUF_POOL_MAX_CLASSES];
+
+	/* Size class statistics, atomically updated when enabled in the
+	 * configuration (see vbuf_pool_get_class_stats()) */
+	uint64_t stat_requests;
+	uint64_t stat_fallbacks;
+	uint64_t stat_failures;
 };
 
 
@@ -117,6 +283,15 @@ struct vbuf_queue {
 };
 
 
+int vbuf_create(size_t capacity,
+		size_t userdata_capacity,
+		size_t meta_capacity,
+		const struct vbuf_cbs *cbs,
+		struct vbuf_pool *pool,
+		unsigned int flags,
+		struct vbuf_buffer **ret_obj);
+
+
 int vbuf_is_ref(struct vbuf_buffer *buf);
 
 
@@ -126,15 +301,92 @@ int vbuf_destroy(struct vbuf_buffer *buf);
 int vbuf_pool_put(struct vbuf_pool *pool, struct vbuf_buffer *buf);
 
 
-struct vbuf_meta *vbuf_meta_new(void *key, unsigned int level, size_t len);
+struct vbuf_meta *vbuf_meta_new(struct vbuf_buffer *buf,
+			       void *key,
+			       unsigned int level,
+			       size_t len,
+			       struct vbuf_meta_blob *blob);
+
+
+int vbuf_meta_destroy(struct vbuf_buffer *buf, struct vbuf_meta *meta);
+
+
+void vbuf_meta_clear(struct vbuf_buffer *buf);
+
+
+/* Remove all the metadata of a buffer that may be accessed by lock-free
+ * readers */
+void vbuf_meta_remove_all(struct vbuf_buffer *buf);
+
+
+void vbuf_segments_clear(struct vbuf_buffer *buf);
+
+
+/* Release a buffer that is no longer referenced: return it to its pool or
+ * destroy it */
+int vbuf_release(struct vbuf_buffer *buf);
+
+
+/* Make the calling thread the owner of a buffer that was just created or
+ * got from its pool: its reference is the first local reference (see
+ * vbuf_ref_local()) */
+void vbuf_local_init(struct vbuf_buffer *buf);
+
+
+int vbuf_reclaim_push(struct vbuf_buffer *buf);
+
 
+/* Wait for the release of all buffers pushed to the reclaimer thread */
+void vbuf_reclaim_flush(void);
 
-int vbuf_meta_destroy(struct vbuf_meta *meta);
+
+/* Register an elastic pool to be trimmed periodically by the reclaimer
+ * thread */
+void vbuf_reclaim_add_pool(struct vbuf_pool *pool);
+
+
+/* Unregister an elastic pool; a trim of the pool in progress is waited
+ * for */
+void vbuf_reclaim_remove_pool(struct vbuf_pool *pool);
+
+
+void vbuf_memcpy(void *dst, const void *src, size_t len);
+
+
+void vbuf_memcpy_2d(uint8_t *dst,
+		    size_t dst_stride,
+		    const uint8_t *src,
+		    size_t src_stride,
+		    size_t width,
+		    size_t height);
+
+
+unsigned int vbuf_worker_get_count(void);
+
+
+void vbuf_worker_submit(struct vbuf_work *work);
+
+
+/* Remove a submitted work that has not been started yet; returns 1 if the
+ * work was removed, 0 otherwise */
+int vbuf_worker_cancel(struct vbuf_work *work);
+
+
+int vbuf_meta_index_add(struct vbuf_buffer *buf, struct vbuf_meta *meta);
+
+
+void vbuf_meta_index_remove(struct vbuf_buffer *buf, struct vbuf_meta *meta);
 
 
 struct vbuf_meta *vbuf_meta_find(struct vbuf_buffer *buf, void *key);
 
 
+static inline size_t vbuf_align_size(size_t size, size_t align)
+{
+	return (size + align - 1) & ~(align - 1);
+}
+
+
 static inline void vbuf_get_time_with_ms_delay(struct timespec *ts,
 					       unsigned int delay)
 {
@@ -186,13 +186,13 @@ int vbuf_queue_peek(struct vbuf_queue *queue,
 	}
 
 	/* Call the callback function if implemented */
-	if (qb->buffer->cbs.queue_peek) {
+	if (qb->buffer->cbs->queue_peek) {
 		VBUF_MUTEX_UNLOCK(&queue->mutex);
 
-		res = (*qb->buffer->cbs.queue_peek)(
+		res = (*qb->buffer->cbs->queue_peek)(
 			qb->buffer,
 			timeout_ms,
-			qb->buffer->cbs.queue_peek_userdata);
+			qb->buffer->cbs->queue_peek_userdata);
 
 		goto out2;
 	}
@@ -260,13 +260,13 @@ int vbuf_queue_pop(struct vbuf_queue *queue,
 	queue->count--;
 
 	/* Call the callback function if implemented */
-	if (qb->buffer->cbs.queue_pop) {
+	if (qb->buffer->cbs->queue_pop) {
 		VBUF_MUTEX_UNLOCK(&queue->mutex);
 
-		res = (*qb->buffer->cbs.queue_pop)(
+		res = (*qb->buffer->cbs->queue_pop)(
 			qb->buffer,
 			timeout_ms,
-			qb->buffer->cbs.queue_pop_userdata);
+			qb->buffer->cbs->queue_pop_userdata);
 		if (res < 0)
 			vbuf_unref(qb->buffer);
 
@@ -284,7 +284,11 @@ out2:
 }
 
 
-int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf)
+/* Push a buffer, either taking a new reference or stealing the caller's
+ * reference (move) */
+static int vbuf_queue_push_internal(struct vbuf_queue *queue,
+				    struct vbuf_buffer *buf,
+				    int move)
 {
 	int res = 0;
 	struct vbuf_buffer *_buf = NULL;
@@ -317,9 +321,9 @@ int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf)
 	}
 
 	/* Call the callback function if implemented */
-	if (buf->cbs.queue_push) {
+	if (buf->cbs->queue_push) {
 		VBUF_MUTEX_UNLOCK(&queue->mutex);
-		res = (*buf->cbs.queue_push)(buf, buf->cbs.queue_push_userdata);
+		res = (*buf->cbs->queue_push)(buf, buf->cbs->queue_push_userdata);
 		if (res < 0)
 			return res;
 		VBUF_MUTEX_LOCK(&queue->mutex);
@@ -335,7 +339,8 @@ int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf)
 	}
 	list_node_unref(&qb->node);
 	qb->buffer = buf;
-	vbuf_ref(buf);
+	if (!move)
+		vbuf_ref(buf);
 
 	/* Add the buffer to the list */
 	list_add_after(list_last(&queue->buffers), &qb->node);
@@ -358,6 +363,46 @@ int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf)
 }
 
 
+int vbuf_queue_push(struct vbuf_queue *queue, struct vbuf_buffer *buf)
+{
+	return vbuf_queue_push_internal(queue, buf, 0);
+}
+
+
+int vbuf_queue_push_move(struct vbuf_queue *queue, struct vbuf_buffer *buf)
+{
+	return vbuf_queue_push_internal(queue, buf, 1);
+}
+
+
+int vbuf_queue_push_fanout(struct vbuf_queue **queues,
+			   unsigned int count,
+			   struct vbuf_buffer *buf)
+{
+	int res, ret = 0;
+	unsigned int i, failed = 0;
+
+	ULOG_ERRNO_RETURN_ERR_IF(queues == NULL, EINVAL);
+	ULOG_ERRNO_RETURN_ERR_IF(buf == NULL, EINVAL);
+
+	/* Take all the references at once, and move them into the queues */
+	vbuf_ref_n(buf, count);
+	for (i = 0; i < count; i++) {
+		res = (queues[i] != NULL) ? vbuf_queue_push_move(queues[i], buf)
+					  : -EINVAL;
+		if (res < 0) {
+			ret = res;
+			failed++;
+		}
+	}
+
+	/* Release the references that were not moved */
+	vbuf_unref_n(buf, failed);
+
+	return ret;
+}
+
+
 int vbuf_queue_abort(struct vbuf_queue *queue)
 {
 	ULOG_ERRNO_RETURN_ERR_IF(queue == NULL, EINVAL);
@@ -0,0 +1,292 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_priv.h"
+
+
+/* Reclaimer thread: releases the buffers whose last reference was dropped
+ * with deferred release enabled; the buffers are pushed on a lock-free
+ * stack and released in batches. It also periodically trims the
+ * registered elastic pools (releasing their idle buffers). The thread is
+ * created on first use and joined when the library is unloaded */
+static struct {
+	/* Pending buffers stack (linked through the reclaim_next member) */
+	struct vbuf_buffer *pending;
+	pthread_mutex_t mutex;
+	/* Signaled when buffers are pushed on an empty stack */
+	pthread_cond_t cond;
+	/* Signaled when a batch has been released or a pool trimmed */
+	pthread_cond_t done_cond;
+	pthread_t thread;
+	int started;
+	int busy;
+	int stop;
+	/* Elastic pools to trim (linked through their trim_node member),
+	 * trim period (the smallest idle timeout of the pools) and next trim
+	 * time */
+	struct list_node pools;
+	unsigned int trim_period_ms;
+	struct timespec trim_time;
+	/* Pool being trimmed, which cannot be unregistered meanwhile */
+	struct vbuf_pool *trim_pool;
+} s_reclaim = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+	.done_cond = PTHREAD_COND_INITIALIZER,
+	.pools = {.next = &s_reclaim.pools, .prev = &s_reclaim.pools},
+};
+static pthread_once_t s_reclaim_once = PTHREAD_ONCE_INIT;
+
+
+/* Take all pending buffers (the mutex must be held) */
+static struct vbuf_buffer *vbuf_reclaim_take(void)
+{
+#if defined(__GNUC__)
+	return __atomic_exchange_n(&s_reclaim.pending, NULL, __ATOMIC_ACQUIRE);
+#else
+#	error no atomic exchange function found on this platform
+#endif
+}
+
+
+static void vbuf_reclaim_release(struct vbuf_buffer *batch)
+{
+	int res;
+	struct vbuf_buffer *buf;
+
+	while (batch != NULL) {
+		buf = batch;
+		batch = buf->reclaim_next;
+		buf->reclaim_next = NULL;
+		res = vbuf_release(buf);
+		if (res < 0)
+			ULOG_ERRNO("vbuf_release", -res);
+	}
+}
+
+
+/* Trim the registered elastic pools (the mutex must be held); the mutex
+ * is released while trimming a pool, which cannot be unregistered and
+ * destroyed meanwhile (see vbuf_reclaim_remove_pool()) */
+static void vbuf_reclaim_trim(void)
+{
+	int res;
+	struct vbuf_pool *pool;
+
+	list_walk_entry_forward(&s_reclaim.pools, pool, trim_node)
+	{
+		s_reclaim.trim_pool = pool;
+		VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+
+		res = vbuf_pool_trim(pool);
+		if (res < 0)
+			ULOG_ERRNO("vbuf_pool_trim", -res);
+
+		VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+		s_reclaim.trim_pool = NULL;
+		VBUF_COND_BROADCAST(&s_reclaim.done_cond);
+	}
+
+	vbuf_get_time_with_ms_delay(&s_reclaim.trim_time,
+				    s_reclaim.trim_period_ms);
+}
+
+
+static void *vbuf_reclaim_thread(void *arg)
+{
+	int err;
+	struct vbuf_buffer *batch;
+
+	VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+	while (1) {
+		/* Pending buffers are released before stopping */
+		batch = vbuf_reclaim_take();
+		if (batch == NULL) {
+			if (s_reclaim.stop)
+				break;
+			if (list_is_empty(&s_reclaim.pools)) {
+				VBUF_COND_WAIT(&s_reclaim.cond,
+					       &s_reclaim.mutex);
+				continue;
+			}
+			err = pthread_cond_timedwait(&s_reclaim.cond,
+						     &s_reclaim.mutex,
+						     &s_reclaim.trim_time);
+			if (err == ETIMEDOUT)
+				vbuf_reclaim_trim();
+			else if (err != 0)
+				ULOG_ERRNO("pthread_cond_timedwait", err);
+			continue;
+		}
+		s_reclaim.busy = 1;
+		VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+
+		vbuf_reclaim_release(batch);
+
+		VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+		s_reclaim.busy = 0;
+		VBUF_COND_BROADCAST(&s_reclaim.done_cond);
+	}
+	VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+
+	return NULL;
+}
+
+
+static void vbuf_reclaim_init(void)
+{
+	int res;
+
+	res = pthread_create(
+		&s_reclaim.thread, NULL, vbuf_reclaim_thread, NULL);
+	if (res != 0) {
+		ULOG_ERRNO("pthread_create", res);
+		return;
+	}
+	s_reclaim.started = 1;
+}
+
+
+__attribute__((destructor)) static void vbuf_reclaim_cleanup(void)
+{
+	if (!s_reclaim.started)
+		return;
+
+	VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+	s_reclaim.stop = 1;
+	VBUF_COND_SIGNAL(&s_reclaim.cond);
+	VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+
+	pthread_join(s_reclaim.thread, NULL);
+	s_reclaim.started = 0;
+}
+
+
+int vbuf_reclaim_push(struct vbuf_buffer *buf)
+{
+	struct vbuf_buffer *head;
+
+	pthread_once(&s_reclaim_once, vbuf_reclaim_init);
+	if (!s_reclaim.started) {
+		/* No reclaimer thread: release the buffer immediately */
+		return vbuf_release(buf);
+	}
+
+#if defined(__GNUC__)
+	head = __atomic_load_n(&s_reclaim.pending, __ATOMIC_RELAXED);
+	do {
+		buf->reclaim_next = head;
+	} while (!__atomic_compare_exchange_n(&s_reclaim.pending,
+					      &head,
+					      buf,
+					      1,
+					      __ATOMIC_RELEASE,
+					      __ATOMIC_RELAXED));
+#else
+#	error no atomic compare and exchange function found on this platform
+#endif
+
+	/* Only wake up the thread for the first buffer of a batch */
+	if (head == NULL) {
+		VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+		VBUF_COND_SIGNAL(&s_reclaim.cond);
+		VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+	}
+
+	return 0;
+}
+
+
+void vbuf_reclaim_add_pool(struct vbuf_pool *pool)
+{
+	pthread_once(&s_reclaim_once, vbuf_reclaim_init);
+	if (!s_reclaim.started) {
+		/* No reclaimer thread: the pool is only trimmed by
+		 * vbuf_pool_trim() calls */
+		ULOGW("no reclaimer thread, pool %p not trimmed", pool);
+		return;
+	}
+
+	VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+	if (list_is_empty(&s_reclaim.pools) ||
+	    (pool->idle_timeout_ms < s_reclaim.trim_period_ms)) {
+		s_reclaim.trim_period_ms = pool->idle_timeout_ms;
+		vbuf_get_time_with_ms_delay(&s_reclaim.trim_time,
+					    s_reclaim.trim_period_ms);
+	}
+	list_add_after(list_last(&s_reclaim.pools), &pool->trim_node);
+	VBUF_COND_SIGNAL(&s_reclaim.cond);
+	VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+}
+
+
+void vbuf_reclaim_remove_pool(struct vbuf_pool *pool)
+{
+	unsigned int period_ms = 0;
+	struct vbuf_pool *p;
+
+	if (!s_reclaim.started)
+		return;
+
+	VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+	/* Wait for the pool trimming in progress, if any */
+	while (s_reclaim.trim_pool == pool)
+		VBUF_COND_WAIT(&s_reclaim.done_cond, &s_reclaim.mutex);
+	list_del(&pool->trim_node);
+
+	/* Update the trim period (0 if there are no more pools) and the
+	 * next trim time if the period changed */
+	list_walk_entry_forward(&s_reclaim.pools, p, trim_node)
+	{
+		if ((period_ms == 0) || (p->idle_timeout_ms < period_ms))
+			period_ms = p->idle_timeout_ms;
+	}
+	if (period_ms != s_reclaim.trim_period_ms) {
+		s_reclaim.trim_period_ms = period_ms;
+		if (period_ms > 0)
+			vbuf_get_time_with_ms_delay(&s_reclaim.trim_time,
+						    period_ms);
+		VBUF_COND_SIGNAL(&s_reclaim.cond);
+	}
+	VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+}
+
+
+void vbuf_reclaim_flush(void)
+{
+	if (!s_reclaim.started)
+		return;
+
+	/* Wait until all pending buffers have been released */
+	VBUF_MUTEX_LOCK(&s_reclaim.mutex);
+	while ((__atomic_load_n(&s_reclaim.pending, __ATOMIC_ACQUIRE) !=
+		NULL) ||
+	       s_reclaim.busy) {
+		VBUF_COND_SIGNAL(&s_reclaim.cond);
+		VBUF_COND_WAIT(&s_reclaim.done_cond, &s_reclaim.mutex);
+	}
+	VBUF_MUTEX_UNLOCK(&s_reclaim.mutex);
+}
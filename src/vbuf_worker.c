@@ -0,0 +1,158 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_priv.h"
+
+
+/* Internal worker threads shared by all asynchronous operations; they are
+ * created on first use and joined when the library is unloaded */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct list_node works;
+	pthread_t threads[VBUF_WORKER_MAX_COUNT];
+	unsigned int count;
+	int stop;
+} s_worker = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+	.cond = PTHREAD_COND_INITIALIZER,
+};
+static pthread_once_t s_worker_once = PTHREAD_ONCE_INIT;
+
+
+static void *vbuf_worker_thread(void *arg)
+{
+	struct vbuf_work *work;
+
+	VBUF_MUTEX_LOCK(&s_worker.mutex);
+	while (1) {
+		/* Pending works are run before stopping */
+		while (list_is_empty(&s_worker.works) && !s_worker.stop)
+			VBUF_COND_WAIT(&s_worker.cond, &s_worker.mutex);
+		if (list_is_empty(&s_worker.works))
+			break;
+
+		work = list_entry(
+			list_first(&s_worker.works), struct vbuf_work, node);
+		list_del(&work->node);
+		list_node_unref(&work->node);
+		VBUF_MUTEX_UNLOCK(&s_worker.mutex);
+
+		(*work->fn)(work);
+
+		VBUF_MUTEX_LOCK(&s_worker.mutex);
+	}
+	VBUF_MUTEX_UNLOCK(&s_worker.mutex);
+
+	return NULL;
+}
+
+
+static void vbuf_worker_init(void)
+{
+	int res;
+	long cpus;
+	unsigned int i, count;
+
+	list_init(&s_worker.works);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	count = (cpus > 1) ? (unsigned int)cpus : 1;
+	if (count > VBUF_WORKER_MAX_COUNT)
+		count = VBUF_WORKER_MAX_COUNT;
+
+	for (i = 0; i < count; i++) {
+		res = pthread_create(
+			&s_worker.threads[i], NULL, vbuf_worker_thread, NULL);
+		if (res != 0) {
+			ULOG_ERRNO("pthread_create", res);
+			break;
+		}
+		s_worker.count++;
+	}
+}
+
+
+__attribute__((destructor)) static void vbuf_worker_cleanup(void)
+{
+	unsigned int i;
+
+	if (s_worker.count == 0)
+		return;
+
+	VBUF_MUTEX_LOCK(&s_worker.mutex);
+	s_worker.stop = 1;
+	VBUF_COND_BROADCAST(&s_worker.cond);
+	VBUF_MUTEX_UNLOCK(&s_worker.mutex);
+
+	for (i = 0; i < s_worker.count; i++)
+		pthread_join(s_worker.threads[i], NULL);
+	s_worker.count = 0;
+}
+
+
+unsigned int vbuf_worker_get_count(void)
+{
+	pthread_once(&s_worker_once, vbuf_worker_init);
+
+	return (s_worker.count > 0) ? s_worker.count : 1;
+}
+
+
+void vbuf_worker_submit(struct vbuf_work *work)
+{
+	pthread_once(&s_worker_once, vbuf_worker_init);
+
+	list_node_unref(&work->node);
+	if (s_worker.count == 0) {
+		/* No worker thread could be created: run the work in the
+		 * calling thread */
+		(*work->fn)(work);
+		return;
+	}
+
+	VBUF_MUTEX_LOCK(&s_worker.mutex);
+	list_add_before(&s_worker.works, &work->node);
+	VBUF_COND_SIGNAL(&s_worker.cond);
+	VBUF_MUTEX_UNLOCK(&s_worker.mutex);
+}
+
+
+int vbuf_worker_cancel(struct vbuf_work *work)
+{
+	int res = 0;
+
+	VBUF_MUTEX_LOCK(&s_worker.mutex);
+	if (list_node_is_ref(&work->node)) {
+		/* Not started yet */
+		list_del(&work->node);
+		list_node_unref(&work->node);
+		res = 1;
+	}
+	VBUF_MUTEX_UNLOCK(&s_worker.mutex);
+
+	return res;
+}
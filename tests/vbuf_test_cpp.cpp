@@ -0,0 +1,126 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_test.h"
+
+#include <video-buffers/vbuf.hpp>
+
+
+/* Moves transfer the reference, clone_ref() takes a new one and reset()
+ * releases it */
+static void test_cpp_buffer(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *raw;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	vbuf::Buffer buf;
+	CU_ASSERT_PTR_NULL(buf.get());
+	res = vbuf::Buffer::create(16, 0, &cbs, buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_PTR_NOT_NULL(buf.get());
+	CU_ASSERT_EQUAL(buf.capacity(), 16);
+	raw = buf.get();
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(raw), 1);
+
+	vbuf::Buffer moved(std::move(buf));
+	CU_ASSERT_PTR_NULL(buf.get());
+	CU_ASSERT_PTR_EQUAL(moved.get(), raw);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(raw), 1);
+
+	{
+		vbuf::Buffer other = moved.clone_ref();
+		CU_ASSERT_PTR_EQUAL(other.get(), raw);
+		CU_ASSERT_EQUAL(vbuf_get_ref_count(raw), 2);
+	}
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(raw), 1);
+
+	/* Keep a reference to check that reset() releases one */
+	vbuf_ref(raw);
+	moved.reset();
+	CU_ASSERT_PTR_NULL(moved.get());
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(raw), 1);
+	vbuf_unref(raw);
+}
+
+
+/* Pool buffers handles return the buffers to the pool, and moving pushes
+ * only give up the reference when the push succeeds */
+static void test_cpp_pool_queue(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = 2;
+	config.capacity = 16;
+	vbuf::Pool pool;
+	res = vbuf::Pool::create(&config, &cbs, pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	vbuf::Queue queue;
+	res = vbuf::Queue::create(1, 0, queue);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	vbuf::Buffer buf1, buf2;
+	res = pool.get(0, buf1);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = pool.get(0, buf2);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(pool.count(), 0);
+
+	res = queue.push(std::move(buf1));
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_PTR_NULL(buf1.get());
+
+	/* The queue is full */
+	res = queue.push(std::move(buf2));
+	CU_ASSERT_EQUAL(res, -EAGAIN);
+	CU_ASSERT_PTR_NOT_NULL(buf2.get());
+	buf2.reset();
+	CU_ASSERT_EQUAL(pool.count(), 1);
+
+	res = queue.pop(0, buf1);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_PTR_NOT_NULL(buf1.get());
+	CU_ASSERT_EQUAL(queue.count(), 0);
+	buf1.reset();
+	CU_ASSERT_EQUAL(pool.count(), 2);
+}
+
+
+CU_TestInfo g_vbuf_test_cpp[] = {
+	{(char *)"buffer", &test_cpp_buffer},
+	{(char *)"pool_queue", &test_cpp_pool_queue},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_test.h"
+
+
+#define TEST_DIRTY_SIZE 65536
+#define TEST_DIRTY_TILE 1024
+
+
+/* Copy the source buffer alternately to two destination buffers: each
+ * destination gets all the modifications */
+static void test_dirty_destinations(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *src = NULL, *dst1 = NULL, *dst2 = NULL;
+	uint8_t *data;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &dst1);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &dst2);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_set_dirty_tracking(src, TEST_DIRTY_TILE);
+	CU_ASSERT_EQUAL(res, 0);
+
+	data = vbuf_get_data(src);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	memset(data, 1, TEST_DIRTY_SIZE);
+	res = vbuf_set_size(src, TEST_DIRTY_SIZE);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst1);
+	CU_ASSERT_EQUAL(res, 0);
+
+	data[10] = 2;
+	res = vbuf_mark_dirty(src, 10, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst2);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst2)[0], 1);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst2)[10], 2);
+
+	/* The tile was cleared by the copy to the other destination */
+	data[20000] = 3;
+	res = vbuf_mark_dirty(src, 20000, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst1);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst1)[10], 2);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst1)[20000], 3);
+
+	/* A destination modified by a copy gets a full copy */
+	res = vbuf_copy_rect(src, 0, 0, dst1, 10, 0, 1, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst1);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst1)[10], 2);
+
+	vbuf_unref(src);
+	vbuf_unref(dst1);
+	vbuf_unref(dst2);
+}
+
+
+/* Regions written by a rectangle copy and the data beyond a previous
+ * size are dirty */
+static void test_dirty_writes(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *src = NULL, *dst = NULL, *other = NULL;
+	uint8_t *data;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &dst);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 0, &cbs, NULL, &other);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_set_dirty_tracking(src, TEST_DIRTY_TILE);
+	CU_ASSERT_EQUAL(res, 0);
+
+	data = vbuf_get_data(src);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	memset(data, 1, TEST_DIRTY_SIZE);
+	res = vbuf_set_size(src, TEST_DIRTY_SIZE);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* Rectangle copy into the source buffer */
+	data = vbuf_get_data(other);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	memset(data, 4, 64);
+	res = vbuf_set_size(other, 64);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_rect(other, 0, 16, src, 30000, 256, 16, 4);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* Size decreased then increased: the data beyond the smaller size
+	 * is modified without being marked */
+	res = vbuf_set_size(src, 1000);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+	data = vbuf_get_data(src);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	data[50000] = 5;
+	res = vbuf_set_size(src, TEST_DIRTY_SIZE);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst)[30000 + 3 * 256 + 15], 4);
+	CU_ASSERT_EQUAL(vbuf_get_cdata(dst)[50000], 5);
+
+	vbuf_unref(src);
+	vbuf_unref(dst);
+	vbuf_unref(other);
+}
+
+
+/* The metadata and user data of the previous copy are replaced by the
+ * incremental copies */
+static void test_dirty_metadata(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *src = NULL, *dst = NULL;
+	uint8_t *data;
+	const uint8_t *cdata;
+	size_t len;
+	int key1, key2;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 16, &cbs, NULL, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(TEST_DIRTY_SIZE, 16, &cbs, NULL, &dst);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_set_dirty_tracking(src, TEST_DIRTY_TILE);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = vbuf_set_size(src, TEST_DIRTY_SIZE);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_add(src, &key1, 0, 4, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	data[0] = 1;
+	data = vbuf_get_userdata(src);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(data);
+	data[0] = 1;
+	res = vbuf_set_userdata_size(src, 1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+
+	/* Incremental copy with the same metadata */
+	res = vbuf_metadata_get(src, &key1, NULL, &len, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	data[0] = 2;
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_cget(dst, &key1, NULL, &len, &cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(len, 4);
+	CU_ASSERT_EQUAL(cdata[0], 2);
+
+	/* Incremental copy with different metadata and no user data */
+	res = vbuf_metadata_remove(src, &key1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_add(src, &key2, 0, 8, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	data[0] = 3;
+	res = vbuf_set_userdata_size(src, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_copy_dirty(src, dst);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_cget(dst, &key1, NULL, &len, &cdata);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+	res = vbuf_metadata_cget(dst, &key2, NULL, &len, &cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(len, 8);
+	CU_ASSERT_EQUAL(cdata[0], 3);
+	CU_ASSERT_EQUAL(vbuf_get_userdata_size(dst), 0);
+
+	vbuf_unref(src);
+	vbuf_unref(dst);
+}
+
+
+CU_TestInfo g_vbuf_test_dirty[] = {
+	{(char *)"destinations", &test_dirty_destinations},
+	{(char *)"writes", &test_dirty_writes},
+	{(char *)"metadata", &test_dirty_metadata},
+	CU_TEST_INFO_NULL,
+};
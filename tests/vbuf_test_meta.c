@@ -0,0 +1,171 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_test.h"
+
+
+static char s_key1;
+static char s_key2;
+
+
+/* Copied metadata is a snapshot: writes on either buffer through
+ * vbuf_metadata_get() are not visible from the other one, and pointers
+ * obtained on shared data remain valid until the buffer is released */
+static void test_meta_shared_cget(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_buffer *src = NULL, *dst = NULL;
+	uint8_t *data = NULL, *dst_data = NULL;
+	const uint8_t *cdata = NULL, *src_cdata = NULL;
+	size_t len = 0;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_new(0, 0, &cbs, NULL, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(0, 0, &cbs, NULL, &dst);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = vbuf_metadata_add(src, &s_key1, 1, 16, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	memset(data, 'A', 16);
+
+	/* The data is shared, the source buffer reference count is
+	 * unchanged */
+	res = vbuf_metadata_copy(src, dst, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(src), 1);
+	res = vbuf_metadata_cget(dst, &s_key1, NULL, &len, &cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(len, 16);
+	res = vbuf_metadata_cget(src, &s_key1, NULL, NULL, &src_cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_PTR_EQUAL(cdata, src_cdata);
+
+	/* Writable pointer on the source: private copy, the destination
+	 * keeps the copied data */
+	res = vbuf_metadata_get(src, &s_key1, NULL, NULL, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_PTR_NOT_EQUAL(data, cdata);
+	memset(data, 'B', 16);
+	res = vbuf_metadata_cget(dst, &s_key1, NULL, NULL, &cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(cdata[0], 'A');
+	CU_ASSERT_EQUAL(cdata[15], 'A');
+
+	/* The destination is no longer sharing its data: no copy */
+	res = vbuf_metadata_get(dst, &s_key1, NULL, NULL, &dst_data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_PTR_EQUAL(dst_data, cdata);
+	memset(dst_data, 'C', 16);
+	res = vbuf_metadata_cget(src, &s_key1, NULL, NULL, &src_cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(src_cdata[0], 'B');
+
+	/* Release the source: the destination data is still valid */
+	res = vbuf_unref(src);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(cdata[0], 'C');
+	CU_ASSERT_EQUAL(cdata[15], 'C');
+
+	res = vbuf_unref(dst);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+/* Pool buffers sharing metadata data are returned to their pool as soon as
+ * they are released, including after copies in both directions */
+static void test_meta_shared_pool(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_pool_config config = {
+		.count = 2,
+		.metadata_capacity = 256,
+	};
+	struct vbuf_buffer *src = NULL, *dst = NULL, *dst2 = NULL;
+	uint8_t *data = NULL;
+	const uint8_t *cdata = NULL;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_pool_get(pool, 0, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_pool_get(pool, 0, &dst);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(0, 0, &cbs, NULL, &dst2);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = vbuf_metadata_add(src, &s_key1, 1, 8, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	memset(data, 0x33, 8);
+	res = vbuf_metadata_add(dst, &s_key2, 2, 8, &data);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	memset(data, 0x44, 8);
+
+	/* Copies in both directions */
+	res = vbuf_metadata_copy(src, dst, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_copy(dst, src, 2);
+	CU_ASSERT_EQUAL(res, -EEXIST);
+	res = vbuf_metadata_remove(src, &s_key1);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_copy(dst, src, 0);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_copy(src, dst2, 2);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_metadata_cget(dst2, &s_key2, NULL, NULL, &cdata);
+	CU_ASSERT_EQUAL(res, -ENOENT);
+	res = vbuf_metadata_cget(dst2, &s_key1, NULL, NULL, &cdata);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* The pool buffers are returned as soon as they are released, the
+	 * shared data remains valid */
+	res = vbuf_unref(src);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 1);
+	res = vbuf_unref(dst);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 2);
+	CU_ASSERT_EQUAL(cdata[0], 0x33);
+	CU_ASSERT_EQUAL(cdata[7], 0x33);
+	res = vbuf_unref(dst2);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+CU_TestInfo g_vbuf_test_meta[] = {
+	{(char *)"shared_cget", &test_meta_shared_cget},
+	{(char *)"shared_pool", &test_meta_shared_pool},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,448 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _GNU_SOURCE
+#	define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+#include "vbuf_test.h"
+
+
+/* Maximum per-CPU cache batch size */
+#define TEST_POOL_MAGAZINE_SIZE 32
+#define TEST_POOL_COUNT (4 * TEST_POOL_MAGAZINE_SIZE)
+#define TEST_POOL_THREADS 4
+#define TEST_POOL_LOOPS 10000
+
+
+/* Run the calling thread on a single CPU, so that all the buffers go
+ * through the same magazine */
+static void test_pool_pin(void)
+{
+	cpu_set_t set;
+	int cpu;
+
+	cpu = sched_getcpu();
+	if (cpu < 0)
+		return;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	sched_setaffinity(0, sizeof(set), &set);
+}
+
+
+static struct vbuf_pool *test_pool_new(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = TEST_POOL_COUNT;
+	config.capacity = 16;
+	config.magazine_size = TEST_POOL_MAGAZINE_SIZE;
+	config.policy = VBUF_POOL_POLICY_CPU_AFFINE;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL(res, 0);
+
+	return pool;
+}
+
+
+/* Get all the buffers (refilling the magazine from the shared free list)
+ * and return them (filling the magazine up to twice its batch size) */
+static void test_pool_magazine_full(void)
+{
+	int res;
+	unsigned int i, j;
+	struct vbuf_pool *pool;
+	struct vbuf_buffer *buf, *bufs[TEST_POOL_COUNT];
+
+	test_pool_pin();
+	pool = test_pool_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < TEST_POOL_COUNT; j++) {
+			res = vbuf_pool_get(pool, 0, &bufs[j]);
+			CU_ASSERT_EQUAL_FATAL(res, 0);
+		}
+		CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 0);
+		res = vbuf_pool_get(pool, 0, &buf);
+		CU_ASSERT_EQUAL(res, -EAGAIN);
+
+		for (j = 0; j < TEST_POOL_COUNT; j++)
+			vbuf_unref(bufs[j]);
+		CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), TEST_POOL_COUNT);
+	}
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+static void *test_pool_thread(void *userdata)
+{
+	struct vbuf_pool *pool = userdata;
+	struct vbuf_buffer *bufs[TEST_POOL_MAGAZINE_SIZE];
+	unsigned int i, j, n;
+
+	test_pool_pin();
+
+	for (i = 0; i < TEST_POOL_LOOPS; i++) {
+		n = 1 + i % TEST_POOL_MAGAZINE_SIZE;
+		for (j = 0; j < n; j++) {
+			if (vbuf_pool_get(pool, -1, &bufs[j]) < 0)
+				return (void *)-1;
+		}
+		while (j > 0)
+			vbuf_unref(bufs[--j]);
+	}
+
+	return NULL;
+}
+
+
+/* Concurrent refills and returns of buffers on the same magazine */
+static void test_pool_magazine_concurrent(void)
+{
+	int res;
+	unsigned int i;
+	void *ret;
+	struct vbuf_pool *pool;
+	pthread_t threads[TEST_POOL_THREADS];
+
+	test_pool_pin();
+	pool = test_pool_new();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	for (i = 0; i < TEST_POOL_THREADS; i++) {
+		res = pthread_create(&threads[i], NULL, test_pool_thread, pool);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+	}
+	for (i = 0; i < TEST_POOL_THREADS; i++) {
+		pthread_join(threads[i], &ret);
+		CU_ASSERT_PTR_NULL(ret);
+	}
+
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), TEST_POOL_COUNT);
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+/* The buffers of a deferred release pool are available as soon as the
+ * pool is created */
+static void test_pool_deferred_release(void)
+{
+	int res;
+	unsigned int i;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_buffer *bufs[4];
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = 4;
+	config.capacity = 16;
+	config.deferred_release = 1;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 4);
+
+	for (i = 0; i < 4; i++) {
+		res = vbuf_pool_get(pool, 0, &bufs[i]);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+	}
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 0);
+
+	/* The buffers are returned by the reclaimer thread */
+	for (i = 0; i < 4; i++)
+		vbuf_unref(bufs[i]);
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+/* The planes descriptors replaced by a copy are restored when the buffer
+ * is returned to its pool */
+static void test_pool_planes(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_buffer *src = NULL, *buf = NULL;
+	struct vbuf_plane plane;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = 1;
+	config.capacity = 64;
+	config.plane_count = 2;
+	config.planes[0].stride = 8;
+	config.planes[0].height = 4;
+	config.planes[1].offset = 32;
+	config.planes[1].stride = 8;
+	config.planes[1].height = 4;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = vbuf_new(64, 0, &cbs, NULL, &src);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	plane = config.planes[0];
+	plane.stride = 16;
+	res = vbuf_set_planes(src, &plane, 1);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = vbuf_pool_get(pool, 0, &buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_copy(src, buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_plane_count(buf), 1);
+	vbuf_unref(buf);
+
+	res = vbuf_pool_get(pool, 0, &buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_plane_count(buf), 2);
+	res = vbuf_get_plane(buf, 0, &plane);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(plane.stride, 8);
+	res = vbuf_get_plane(buf, 1, &plane);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(plane.offset, 32);
+	vbuf_unref(buf);
+
+	vbuf_unref(src);
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+static struct vbuf_pool *test_pool_ring_new(unsigned int count)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool *pool = NULL;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = count;
+	config.capacity = 16;
+	config.lock_free = 1;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL(res, 0);
+
+	return pool;
+}
+
+
+/* The lock-free free list ring (rounded up to 4 slots for 3 buffers)
+ * wraps around while keeping the buffers order */
+static void test_pool_ring_wrap(void)
+{
+	int res;
+	unsigned int i, j;
+	struct vbuf_pool *pool;
+	struct vbuf_buffer *buf, *bufs[3];
+
+	pool = test_pool_ring_new(3);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	for (j = 0; j < 3; j++) {
+		res = vbuf_pool_get(pool, 0, &bufs[j]);
+		CU_ASSERT_EQUAL_FATAL(res, 0);
+	}
+	res = vbuf_pool_get(pool, 0, &buf);
+	CU_ASSERT_EQUAL(res, -EAGAIN);
+
+	for (i = 0; i < 10; i++) {
+		for (j = 0; j < 3; j++)
+			vbuf_unref(bufs[j]);
+		CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 3);
+		for (j = 0; j < 3; j++) {
+			res = vbuf_pool_get(pool, 0, &buf);
+			CU_ASSERT_EQUAL_FATAL(res, 0);
+			CU_ASSERT_PTR_EQUAL(buf, bufs[j]);
+		}
+		CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 0);
+	}
+
+	for (j = 0; j < 3; j++)
+		vbuf_unref(bufs[j]);
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+static void *test_pool_waiter_thread(void *userdata)
+{
+	struct vbuf_pool *pool = userdata;
+	struct vbuf_buffer *buf = NULL;
+
+	if (vbuf_pool_get(pool, 5000, &buf) < 0)
+		return NULL;
+
+	return buf;
+}
+
+
+/* A vbuf_pool_get() caller waiting on an empty lock-free pool is woken up
+ * when a buffer is returned */
+static void test_pool_ring_waiter(void)
+{
+	int res;
+	void *ret;
+	struct vbuf_pool *pool;
+	struct vbuf_buffer *buf = NULL;
+	pthread_t thread;
+
+	pool = test_pool_ring_new(1);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(pool);
+
+	res = vbuf_pool_get(pool, 0, &buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = pthread_create(&thread, NULL, test_pool_waiter_thread, pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	usleep(50000);
+	vbuf_unref(buf);
+	pthread_join(thread, &ret);
+	CU_ASSERT_PTR_EQUAL(ret, buf);
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 0);
+
+	if (ret != NULL)
+		vbuf_unref(ret);
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+/* Requests of a size class served by a larger class and failed requests
+ * are counted in the statistics of the requested class */
+static void test_pool_class_stats(void)
+{
+	int res;
+	unsigned int i;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool_config config;
+	struct vbuf_pool_class_stats stats;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_buffer *buf = NULL, *bufs[3];
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+
+	memset(&config, 0, sizeof(config));
+	config.count = 1;
+	config.class_count = 3;
+	config.classes[0].capacity = 64;
+	config.classes[0].count = 1;
+	config.classes[1].capacity = 256;
+	config.classes[1].count = 1;
+	config.classes[2].capacity = 1024;
+	config.classes[2].count = 1;
+	config.class_stats = 1;
+	res = vbuf_pool_new_ext(&config, &cbs, &pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_pool_get_class_count(pool), 3);
+
+	res = vbuf_pool_get_sized(pool, 100, 0, &bufs[1]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_capacity(bufs[1]), 256);
+	res = vbuf_pool_get_sized(pool, 50, 0, &bufs[0]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_capacity(bufs[0]), 64);
+
+	/* Served by the largest class */
+	res = vbuf_pool_get_sized(pool, 50, 0, &bufs[2]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_capacity(bufs[2]), 1024);
+
+	/* No buffer left, and no class large enough */
+	res = vbuf_pool_get_sized(pool, 50, 0, &buf);
+	CU_ASSERT_EQUAL(res, -EAGAIN);
+	res = vbuf_pool_get_sized(pool, 2048, 0, &buf);
+	CU_ASSERT_EQUAL(res, -ENOBUFS);
+
+	res = vbuf_pool_get_class_stats(pool, 0, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.capacity, 64);
+	CU_ASSERT_EQUAL(stats.count, 1);
+	CU_ASSERT_EQUAL(stats.free, 0);
+	CU_ASSERT_EQUAL(stats.requests, 3);
+	CU_ASSERT_EQUAL(stats.fallbacks, 1);
+	CU_ASSERT_EQUAL(stats.failures, 1);
+	res = vbuf_pool_get_class_stats(pool, 1, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.requests, 1);
+	CU_ASSERT_EQUAL(stats.fallbacks, 0);
+	CU_ASSERT_EQUAL(stats.failures, 0);
+	res = vbuf_pool_get_class_stats(pool, 2, &stats);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(stats.requests, 0);
+
+	/* The buffers return to the pool of their class */
+	for (i = 0; i < 3; i++)
+		vbuf_unref(bufs[i]);
+	for (i = 0; i < 3; i++) {
+		res = vbuf_pool_get_class_stats(pool, i, &stats);
+		CU_ASSERT_EQUAL(res, 0);
+		CU_ASSERT_EQUAL(stats.free, 1);
+	}
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+CU_TestInfo g_vbuf_test_pool[] = {
+	{(char *)"magazine_full", &test_pool_magazine_full},
+	{(char *)"magazine_concurrent", &test_pool_magazine_concurrent},
+	{(char *)"deferred_release", &test_pool_deferred_release},
+	{(char *)"planes", &test_pool_planes},
+	{(char *)"ring_wrap", &test_pool_ring_wrap},
+	{(char *)"ring_waiter", &test_pool_ring_waiter},
+	{(char *)"class_stats", &test_pool_class_stats},
+	CU_TEST_INFO_NULL,
+};
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "vbuf_test.h"
+
+
+/* The references that were not moved into a queue are released when some
+ * pushes fail */
+static void test_queue_fanout(void)
+{
+	int res;
+	struct vbuf_cbs cbs;
+	struct vbuf_queue *queues[3] = {NULL, NULL, NULL};
+	struct vbuf_buffer *buf = NULL, *other = NULL;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_new(16, 0, &cbs, NULL, &buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_new(16, 0, &cbs, NULL, &other);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	/* A full queue that does not drop buffers, a queue and no queue */
+	res = vbuf_queue_new(1, 0, &queues[0]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_queue_new(0, 0, &queues[1]);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	res = vbuf_queue_push_move(queues[0], other);
+	CU_ASSERT_EQUAL(res, 0);
+
+	res = vbuf_queue_push_fanout(queues, 3, buf);
+	CU_ASSERT_EQUAL(res, -EINVAL);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 2);
+	CU_ASSERT_EQUAL(vbuf_queue_get_count(queues[0]), 1);
+	CU_ASSERT_EQUAL(vbuf_queue_get_count(queues[1]), 1);
+
+	/* All pushes succeed */
+	res = vbuf_queue_push_fanout(&queues[1], 1, buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 3);
+	CU_ASSERT_EQUAL(vbuf_queue_get_count(queues[1]), 2);
+
+	res = vbuf_queue_flush(queues[1]);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 1);
+
+	vbuf_queue_flush(queues[0]);
+	vbuf_queue_destroy(queues[0]);
+	vbuf_queue_destroy(queues[1]);
+	vbuf_unref(buf);
+}
+
+
+CU_TestInfo g_vbuf_test_queue[] = {
+	{(char *)"fanout", &test_queue_fanout},
+	CU_TEST_INFO_NULL,
+};
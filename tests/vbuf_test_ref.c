@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) 2017 Parrot Drones SAS
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *   * Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *   * Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *   * Neither the name of the Parrot Drones SAS Company nor the
+ *     names of its contributors may be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE PARROT DRONES SAS COMPANY BE LIABLE FOR
+ * ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <pthread.h>
+
+#include "vbuf_test.h"
+
+#include <video-buffers/vbuf_private.h>
+
+
+/* Reference count held by the buffer on behalf of all the threads */
+static int test_ref_shared_count(struct vbuf_buffer *buf)
+{
+	return (int)__atomic_load_n(&buf->ref_count, __ATOMIC_RELAXED);
+}
+
+
+static void *test_ref_thread(void *userdata)
+{
+	struct vbuf_buffer *buf = userdata;
+
+	/* Not the owner thread: regular references */
+	vbuf_ref_local(buf);
+	vbuf_ref_local(buf);
+	if (test_ref_shared_count(buf) != 3)
+		return (void *)-1;
+	vbuf_unref_local(buf);
+	vbuf_unref_local(buf);
+	if (test_ref_shared_count(buf) != 1)
+		return (void *)-1;
+
+	return NULL;
+}
+
+
+/* The owner thread reference is its first local reference: the shared
+ * count is only modified when the last local reference is released or
+ * when other threads take references */
+static void test_ref_local(void)
+{
+	int res;
+	void *ret;
+	unsigned int i;
+	struct vbuf_cbs cbs;
+	struct vbuf_pool *pool = NULL;
+	struct vbuf_buffer *buf = NULL;
+	pthread_t thread;
+
+	res = vbuf_generic_get_cbs(&cbs);
+	CU_ASSERT_EQUAL(res, 0);
+	res = vbuf_pool_new(1, 16, 0, &cbs, &pool);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+
+	res = vbuf_pool_get(pool, 0, &buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 1);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 1);
+
+	/* Local references of the owner thread */
+	for (i = 0; i < 4; i++) {
+		res = vbuf_ref_local(buf);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 1);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 5);
+	for (i = 0; i < 4; i++) {
+		res = vbuf_unref_local(buf);
+		CU_ASSERT_EQUAL(res, 0);
+	}
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 1);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 1);
+
+	/* References of another thread */
+	res = pthread_create(&thread, NULL, test_ref_thread, buf);
+	CU_ASSERT_EQUAL_FATAL(res, 0);
+	pthread_join(thread, &ret);
+	CU_ASSERT_PTR_NULL(ret);
+
+	/* Regular reference of the owner thread: the local references are
+	 * released first */
+	res = vbuf_ref(buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 2);
+	res = vbuf_unref(buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 1);
+	CU_ASSERT_EQUAL(vbuf_get_ref_count(buf), 1);
+
+	/* The thread stays the owner */
+	res = vbuf_ref_local(buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 2);
+	res = vbuf_unref_local(buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(test_ref_shared_count(buf), 1);
+
+	res = vbuf_unref(buf);
+	CU_ASSERT_EQUAL(res, 0);
+	CU_ASSERT_EQUAL(vbuf_pool_get_count(pool), 1);
+
+	res = vbuf_pool_destroy(pool);
+	CU_ASSERT_EQUAL(res, 0);
+}
+
+
+CU_TestInfo g_vbuf_test_ref[] = {
+	{(char *)"local", &test_ref_local},
+	CU_TEST_INFO_NULL,
+};